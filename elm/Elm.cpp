@@ -48,13 +48,18 @@ void OnMouseButton(GLFWwindow* window, int button, int action, int modifier) {
     Vector2f world_pos = elm->camera.Unproject(Vector2f(xpos, ypos));
 
     // ELvl test code
+    const elvl::Region* regions[32];
+    size_t region_count = elm->map->GetRegions((u16)world_pos.x, (u16)world_pos.y, regions);
+
+    if (region_count > 32) region_count = 32;
+
     printf("Regions: ");
-    for (auto& region : elm->map->GetRegions(world_pos)) {
-      printf("%s, ", region->name.data());
+    for (size_t i = 0; i < region_count; ++i) {
+      printf("%s, ", regions[i]->name.data());
     }
     printf("\n");
 
-    if (elm->map->InRegion("fr", world_pos)) {
+    if (elm->map->InRegion(elm->flag_room, world_pos)) {
       printf("Is a flag room.\n");
     }
 
@@ -87,6 +92,7 @@ bool Elm::Initialize(const char* map_filename, std::unique_ptr<Map> map) {
   OGLErrorCheck();
 
   this->map = std::move(map);
+  flag_room = this->map->GetRegionHandle("fr");
 
   return true;
 }
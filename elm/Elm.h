@@ -29,6 +29,7 @@ struct Elm {
   float ship_radius;
 
   std::unique_ptr<Map> map;
+  RegionHandle flag_room;
 
   Vector2f path_start;
   Vector2f path_end;
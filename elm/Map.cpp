@@ -1,8 +1,13 @@
 #include "Map.h"
 
+#include <elm/MappedFile.h>
+#include <elm/OccupancyLayer.h>
+
+#include <algorithm>
+#include <bit>
 #include <bitset>
+#include <cstdio>
 #include <cstring>
-#include <fstream>
 #include <string_view>
 
 namespace elm {
@@ -10,18 +15,21 @@ namespace elm {
 bool solid_tiles[256];
 
 bool IsSolidSquare(const Map& map, MapCoord top_left, int length) {
-  u16 abs_x = top_left.x;
-  u16 abs_y = top_left.y;
+  if (length <= 0) return false;
 
-  for (uint16_t x = 0; x < length; x++) {
-    for (uint16_t y = 0; y < length; y++) {
-      if (map.IsSolid(abs_x + x, abs_y + y)) {
-        return true;
-      }
-    }
-  }
+  s32 end_x = top_left.x + length - 1;
+  s32 end_y = top_left.y + length - 1;
 
-  return false;
+  return map.IsSolidRect(top_left.x, top_left.y, end_x, end_y);
+}
+
+// Checks if the (d + 1) x (d + 1) box that starts at the check tile and extends d tiles in the given direction is empty.
+inline bool CanFitBox(const Map& map, s32 check_x, s32 check_y, s32 dir_x, s32 dir_y, s32 d) {
+  s32 end_x = check_x + dir_x * d;
+  s32 end_y = check_y + dir_y * d;
+
+  return !map.IsSolidRect(std::min(check_x, end_x), std::min(check_y, end_y), std::max(check_x, end_x),
+                          std::max(check_y, end_y));
 }
 
 constexpr size_t kMaxOccupySet = 96;
@@ -72,7 +80,12 @@ bool Map::CanMoveTo(MapCoord from, MapCoord to, float radius) const {
   return false;
 }
 
-Map::Map(const TileData& tile_data) : tile_data_(tile_data) {
+Map::Map(TileData tile_data)
+    : tile_data_(std::move(tile_data)),
+      solid_bits_(kSolidRowWords * kMapExtent),
+      solid_sums_((kMapExtent + 1) * (kMapExtent + 1)),
+      wall_distance_sq_(kMapExtent * kMapExtent),
+      wall_column_distance_(kMapExtent * kMapExtent) {
   memset(solid_tiles, 1, sizeof(solid_tiles) / sizeof(*solid_tiles));
   solid_tiles[0] = false;
 
@@ -85,6 +98,484 @@ Map::Map(const TileData& tile_data) : tile_data_(tile_data) {
   solid_tiles[253] = false;
   solid_tiles[254] = false;
   solid_tiles[255] = false;
+
+  for (std::size_t i = 0; i < kMapExtent * kMapExtent; ++i) {
+    TileId id = tile_data_[i];
+
+    if (IsSolid(id)) {
+      solid_bits_[i >> 6] |= 1ULL << (i & 63);
+    }
+
+    if (id >= kFirstDoorTileId && id < kFirstDoorTileId + kDoorGroupCount) {
+      door_tiles_[id - kFirstDoorTileId].push_back((u32)i);
+    }
+  }
+
+  // Build the summed-area table. The first row and column are left as zero so lookups don't need edge checks.
+  constexpr std::size_t kSumsStride = kMapExtent + 1;
+
+  for (std::size_t y = 0; y < kMapExtent; ++y) {
+    u32 row_sum = 0;
+
+    for (std::size_t x = 0; x < kMapExtent; ++x) {
+      row_sum += IsSolid((u16)x, (u16)y);
+      solid_sums_[(y + 1) * kSumsStride + (x + 1)] = solid_sums_[y * kSumsStride + (x + 1)] + row_sum;
+    }
+  }
+
+  BuildWallDistanceField();
+}
+
+Map::~Map() {}
+
+// Computes the exact squared euclidean distance from each tile to the closest solid tile.
+// This is the separable transform from Meijster et al. The map is surrounded by a solid border so the distance to the
+// edge of the map is included, matching IsSolid treating out of bounds tiles as solid.
+void Map::BuildWallDistanceField() {
+  for (s32 x = 0; x < (s32)kMapExtent; ++x) {
+    BuildWallColumnDistance(x, nullptr);
+  }
+
+  for (s32 y = 0; y < (s32)kMapExtent; ++y) {
+    BuildWallDistanceRow(y);
+  }
+}
+
+void Map::BuildWallColumnDistance(s32 x, std::vector<WallColumnChange>* changes) {
+  u16 column[kMapExtent];
+  u16 distance = 0;
+
+  for (std::size_t y = 0; y < kMapExtent; ++y) {
+    distance = IsSolid((u16)x, (u16)y) ? 0 : distance + 1;
+    column[y] = distance;
+  }
+
+  distance = 0;
+
+  for (std::size_t y = kMapExtent; y-- > 0;) {
+    distance = IsSolid((u16)x, (u16)y) ? 0 : distance + 1;
+
+    if (distance < column[y]) column[y] = distance;
+  }
+
+  for (std::size_t y = 0; y < kMapExtent; ++y) {
+    u16& current = wall_column_distance_[y * kMapExtent + x];
+
+    if (current != column[y]) {
+      if (changes) changes->push_back({x, (s32)y, current});
+
+      current = column[y];
+    }
+  }
+}
+
+void Map::UpdateWallDistanceRow(s32 y, const WallColumnChange* changes, std::size_t count) {
+  const u16* row = &wall_column_distance_[(std::size_t)y * kMapExtent];
+
+  // The largest column distance that the column had before or after the change. The border columns are solid.
+  auto get_max_distance = [row, changes, count](s32 x) -> s32 {
+    if (x < 0 || x >= (s32)kMapExtent) return 0;
+
+    s32 distance = row[x];
+
+    for (std::size_t i = 0; i < count; ++i) {
+      if (changes[i].x == x && changes[i].old_distance > distance) {
+        distance = changes[i].old_distance;
+      }
+    }
+
+    return distance;
+  };
+
+  // Exact squared distance for one tile. Columns are checked outward until they can't be any closer.
+  auto find_distance_sq = [row](s32 x) -> u32 {
+    s32 best = (s32)row[x] * row[x];
+
+    for (s32 offset = 1; offset * offset < best; ++offset) {
+      s32 left = x - offset;
+      s32 right = x + offset;
+
+      s32 left_distance = left < 0 ? 0 : row[left];
+      s32 right_distance = right >= (s32)kMapExtent ? 0 : row[right];
+
+      best = std::min(best, offset * offset + left_distance * left_distance);
+      best = std::min(best, offset * offset + right_distance * right_distance);
+    }
+
+    return (u32)best;
+  };
+
+  for (std::size_t i = 0; i < count; ++i) {
+    s32 x = changes[i].x;
+    s32 min_distance = std::min<s32>(changes[i].old_distance, row[x]);
+
+    // A column can only be the closest for tiles until it reaches a column that is at least as close with both the old
+    // and new distances. Past that point the changed column never mattered, so the window stops there.
+    s32 start_x = x;
+    s32 end_x = x;
+
+    for (s32 w = x + 1;; ++w) {
+      s32 w_distance = get_max_distance(w);
+      if (w_distance * w_distance <= (w - x) * (w - x) + min_distance * min_distance) break;
+      end_x = w;
+    }
+
+    for (s32 w = x - 1;; --w) {
+      s32 w_distance = get_max_distance(w);
+      if (w_distance * w_distance <= (w - x) * (w - x) + min_distance * min_distance) break;
+      start_x = w;
+    }
+
+    for (s32 u = start_x; u <= end_x; ++u) {
+      wall_distance_sq_[(std::size_t)y * kMapExtent + u] = find_distance_sq(u);
+    }
+  }
+}
+
+void Map::BuildWallDistanceRow(s32 y) {
+  // The row pass includes one solid border tile on each side.
+  constexpr s32 kRowSize = (s32)kMapExtent + 2;
+
+  s32 g[kRowSize];
+  s32 s[kRowSize];
+  s32 t[kRowSize];
+
+  auto f = [&g](s32 x, s32 i) { return (x - i) * (x - i) + g[i] * g[i]; };
+  auto sep = [&g](s32 i, s32 u) {
+    s32 numerator = (u * u - i * i + g[u] * g[u] - g[i] * g[i]);
+    s32 denominator = 2 * (u - i);
+    // Round down for negative numerators.
+    return numerator >= 0 ? numerator / denominator : -((-numerator + denominator - 1) / denominator);
+  };
+
+  g[0] = 0;
+  g[kRowSize - 1] = 0;
+
+  for (std::size_t x = 0; x < kMapExtent; ++x) {
+    g[x + 1] = wall_column_distance_[y * kMapExtent + x];
+  }
+
+  s32 q = 0;
+  s[0] = 0;
+  t[0] = 0;
+
+  for (s32 u = 1; u < kRowSize; ++u) {
+    while (q >= 0 && f(t[q], s[q]) > f(t[q], u)) {
+      --q;
+    }
+
+    if (q < 0) {
+      q = 0;
+      s[0] = u;
+    } else {
+      s32 w = 1 + sep(s[q], u);
+
+      if (w < kRowSize) {
+        ++q;
+        s[q] = u;
+        t[q] = w;
+      }
+    }
+  }
+
+  for (s32 u = kRowSize - 1; u >= 0; --u) {
+    if (u >= 1 && u <= (s32)kMapExtent) {
+      wall_distance_sq_[y * kMapExtent + (u - 1)] = (u32)f(u, s[q]);
+    }
+
+    if (u == t[q]) --q;
+  }
+}
+
+u32 Map::GetWallDistanceSq(u16 x, u16 y) const {
+  if (x >= 1024 || y >= 1024) return 0;
+  return wall_distance_sq_[(std::size_t)y * kMapExtent + x];
+}
+
+float Map::GetWallDistance(u16 x, u16 y) const { return std::sqrt((float)GetWallDistanceSq(x, y)); }
+
+std::vector<MapRect> Map::SetDoorState(u8 closed_doors) {
+  u8 changed_groups = closed_doors_ ^ closed_doors;
+
+  if (changed_groups == 0) return {};
+
+  closed_doors_ = closed_doors;
+
+  std::vector<u32> changed_tiles;
+
+  for (std::size_t group = 0; group < kDoorGroupCount; ++group) {
+    if (changed_groups & (1 << group)) {
+      changed_tiles.insert(changed_tiles.end(), door_tiles_[group].begin(), door_tiles_[group].end());
+    }
+  }
+
+  return UpdateSolidTiles(changed_tiles);
+}
+
+std::vector<MapRect> Map::SetDoorOpen(TileId door_id, bool open) {
+  if (door_id < kFirstDoorTileId || door_id >= kFirstDoorTileId + kDoorGroupCount) return {};
+
+  u8 bit = 1 << (door_id - kFirstDoorTileId);
+
+  return SetDoorState(open ? (closed_doors_ & ~bit) : (closed_doors_ | bit));
+}
+
+std::vector<MapRect> Map::UpdateDoors(s32 door_mode) {
+  if (door_mode >= 0) {
+    return SetDoorState((u8)door_mode);
+  }
+
+  auto next = [this]() {
+    // Linear congruential generator. The high bits are used because the low bits have short periods.
+    door_seed_ = door_seed_ * 1103515245 + 12345;
+    return (door_seed_ >> 16) & 0x7FFF;
+  };
+
+  u8 closed_doors = 0;
+
+  if (door_mode == -1) {
+    // Each door group is closed with a chance of (group + 1) / 9, so lower groups are open more often.
+    for (std::size_t group = 0; group < kDoorGroupCount; ++group) {
+      if (next() % 9 <= group) {
+        closed_doors |= 1 << group;
+      }
+    }
+  } else {
+    closed_doors = (u8)next();
+  }
+
+  return SetDoorState(closed_doors);
+}
+
+// Changed tiles that are close together are updated as one rect so their overlapping work isn't repeated.
+static void AddChangedTile(std::vector<MapRect>& rects, s32 x, s32 y) {
+  constexpr s32 kMergeDistance = 8;
+
+  for (MapRect& rect : rects) {
+    if (rect.Expand(kMergeDistance).Contains(x, y)) {
+      rect.start_x = std::min(rect.start_x, x);
+      rect.start_y = std::min(rect.start_y, y);
+      rect.end_x = std::max(rect.end_x, x);
+      rect.end_y = std::max(rect.end_y, y);
+      return;
+    }
+  }
+
+  rects.emplace_back(x, y, x, y);
+}
+
+std::vector<MapRect> Map::UpdateSolidTiles(const std::vector<u32>& indexes) {
+  std::vector<MapRect> rects;
+
+  if (indexes.empty()) return rects;
+
+  s32 min_x = (s32)kMapExtent;
+  s32 min_y = (s32)kMapExtent;
+
+  u8 dirty_columns[kMapExtent] = {};
+
+  for (u32 index : indexes) {
+    s32 x = (s32)(index % kMapExtent);
+    s32 y = (s32)(index / kMapExtent);
+
+    if (IsSolid(tile_data_[index])) {
+      solid_bits_[index >> 6] |= 1ULL << (index & 63);
+    } else {
+      solid_bits_[index >> 6] &= ~(1ULL << (index & 63));
+    }
+
+    if (x < min_x) min_x = x;
+    if (y < min_y) min_y = y;
+
+    dirty_columns[x] = 1;
+
+    AddChangedTile(rects, x, y);
+  }
+
+  // Each changed tile adds or removes one from every sum below and to the right of it. The changes in a row are
+  // accumulated along the row, then carried down through column_delta, so only the sums from min_x need to be touched.
+  constexpr std::size_t kSumsStride = kMapExtent + 1;
+
+  std::vector<u32> sorted_indexes(indexes);
+  std::sort(sorted_indexes.begin(), sorted_indexes.end());
+
+  s32 column_delta[kSumsStride] = {};
+  s32 row_delta[kSumsStride] = {};
+  std::size_t next_index = 0;
+
+  for (s32 y = min_y; y < (s32)kMapExtent; ++y) {
+    if (next_index < sorted_indexes.size() && (s32)(sorted_indexes[next_index] / kMapExtent) == y) {
+      while (next_index < sorted_indexes.size() && (s32)(sorted_indexes[next_index] / kMapExtent) == y) {
+        u32 index = sorted_indexes[next_index++];
+
+        row_delta[index % kMapExtent + 1] += IsSolid(tile_data_[index]) ? 1 : -1;
+      }
+
+      s32 running_delta = 0;
+
+      for (s32 x = min_x + 1; x < (s32)kSumsStride; ++x) {
+        running_delta += row_delta[x];
+        row_delta[x] = 0;
+        column_delta[x] += running_delta;
+      }
+    }
+
+    u32* sums = &solid_sums_[(y + 1) * kSumsStride];
+
+    for (s32 x = min_x + 1; x < (s32)kSumsStride; ++x) {
+      sums[x] += column_delta[x];
+    }
+  }
+
+  // The column pass is redone for each changed column, then each row is updated around the columns that changed in it.
+  std::vector<WallColumnChange> column_changes;
+
+  for (s32 x = 0; x < (s32)kMapExtent; ++x) {
+    if (dirty_columns[x]) {
+      BuildWallColumnDistance(x, &column_changes);
+    }
+  }
+
+  std::sort(column_changes.begin(), column_changes.end(),
+            [](const WallColumnChange& lhs, const WallColumnChange& rhs) { return lhs.y < rhs.y; });
+
+  for (std::size_t begin = 0; begin < column_changes.size();) {
+    std::size_t end = begin + 1;
+
+    while (end < column_changes.size() && column_changes[end].y == column_changes[begin].y) {
+      ++end;
+    }
+
+    UpdateWallDistanceRow(column_changes[begin].y, &column_changes[begin], end - begin);
+    begin = end;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(occupancy_mutex_);
+
+    for (auto& layer : occupancy_layers_) {
+      for (const MapRect& rect : rects) {
+        layer->Update(rect);
+      }
+    }
+  }
+
+  for (auto& entry : change_listeners_) {
+    entry.second(*this, rects, TileChangeType::Solidity);
+  }
+
+  return rects;
+}
+
+std::vector<MapRect> Map::SetTile(u16 x, u16 y, TileId id) {
+  TileChange change = {x, y, id};
+
+  return SetTiles(std::span<const TileChange>(&change, 1));
+}
+
+std::vector<MapRect> Map::SetTiles(std::span<const TileChange> changes) {
+  // Each changed index with the id it had before any of the changes.
+  std::vector<std::pair<u32, TileId>> changed;
+
+  changed.reserve(changes.size());
+
+  for (const TileChange& change : changes) {
+    if (change.x >= kMapExtent || change.y >= kMapExtent) continue;
+
+    u32 index = (u32)change.y * kMapExtent + change.x;
+    TileId old_id = tile_data_[index];
+
+    if (old_id == change.id) continue;
+
+    if (old_id >= kFirstDoorTileId && old_id < kFirstDoorTileId + kDoorGroupCount) {
+      std::vector<u32>& group = door_tiles_[old_id - kFirstDoorTileId];
+      group.erase(std::find(group.begin(), group.end(), index));
+    }
+
+    if (change.id >= kFirstDoorTileId && change.id < kFirstDoorTileId + kDoorGroupCount) {
+      door_tiles_[change.id - kFirstDoorTileId].push_back(index);
+    }
+
+    tile_data_[index] = change.id;
+    changed.emplace_back(index, old_id);
+  }
+
+  // The first change to an index is kept since it has the original id.
+  auto index_less = [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; };
+  auto index_equal = [](const auto& lhs, const auto& rhs) { return lhs.first == rhs.first; };
+
+  std::stable_sort(changed.begin(), changed.end(), index_less);
+  changed.erase(std::unique(changed.begin(), changed.end(), index_equal), changed.end());
+
+  // Only tiles that changed solidity affect the map's derived data. The solid bits still hold the old solidity here.
+  // Tiles that keep their solidity are only reported if they changed between safe and unsafe, since the safe tiles
+  // are the only other thing that the navigation data is built from.
+  std::vector<u32> solid_indexes;
+  std::vector<MapRect> safe_rects;
+
+  for (const auto& [index, old_id] : changed) {
+    TileId id = tile_data_[index];
+    bool was_solid = (solid_bits_[index >> 6] >> (index & 63)) & 1;
+
+    if (was_solid != IsSolid(id)) {
+      solid_indexes.push_back(index);
+    } else if ((old_id == kSafeTileId) != (id == kSafeTileId)) {
+      AddChangedTile(safe_rects, (s32)(index % kMapExtent), (s32)(index / kMapExtent));
+    }
+  }
+
+  std::vector<MapRect> rects = UpdateSolidTiles(solid_indexes);
+
+  if (!safe_rects.empty()) {
+    for (auto& entry : change_listeners_) {
+      entry.second(*this, safe_rects, TileChangeType::Safe);
+    }
+  }
+
+  return rects;
+}
+
+std::size_t Map::AddChangeListener(ChangeListener listener) {
+  std::size_t id = next_listener_id_++;
+
+  change_listeners_.emplace_back(id, std::move(listener));
+
+  return id;
+}
+
+void Map::RemoveChangeListener(std::size_t id) {
+  for (auto iter = change_listeners_.begin(); iter != change_listeners_.end(); ++iter) {
+    if (iter->first == id) {
+      change_listeners_.erase(iter);
+      return;
+    }
+  }
+}
+
+u64 Map::GetTileHash() const {
+  // FNV-1a
+  u64 hash = 14695981039346656037ULL;
+
+  for (TileId id : tile_data_) {
+    hash ^= id;
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+const OccupancyLayer& Map::GetOccupancyLayer(float radius) const {
+  std::lock_guard<std::mutex> guard(occupancy_mutex_);
+
+  for (auto& layer : occupancy_layers_) {
+    if (layer->GetRadius() == radius) {
+      return *layer;
+    }
+  }
+
+  occupancy_layers_.push_back(std::make_unique<OccupancyLayer>(*this, radius));
+
+  return *occupancy_layers_.back();
 }
 
 TileId Map::GetTileId(u16 x, u16 y) const {
@@ -94,12 +585,47 @@ TileId Map::GetTileId(u16 x, u16 y) const {
 
 bool Map::IsSolid(u16 x, u16 y) const {
   if (x >= 1024 || y >= 1024) return true;
-  return IsSolid(GetTileId(x, y));
+
+  std::size_t index = (std::size_t)y * kMapExtent + x;
+  return (solid_bits_[index >> 6] >> (index & 63)) & 1;
+}
+
+bool Map::IsSolidRow(s32 y, s32 start_x, s32 end_x) const {
+  if (start_x > end_x) return false;
+  if (y < 0 || y >= 1024 || start_x < 0 || end_x >= 1024) return true;
+
+  return TestRowSpan(&solid_bits_[(std::size_t)y * kSolidRowWords], start_x, end_x);
+}
+
+bool Map::IsSolidRect(s32 start_x, s32 start_y, s32 end_x, s32 end_y) const {
+  if (start_x > end_x || start_y > end_y) return false;
+  if (start_y < 0 || end_y >= 1024 || start_x < 0 || end_x >= 1024) return true;
+
+  return GetSolidCount(start_x, start_y, end_x, end_y) > 0;
+}
+
+u32 Map::GetSolidCount(s32 start_x, s32 start_y, s32 end_x, s32 end_y) const {
+  constexpr std::size_t kSumsStride = kMapExtent + 1;
+
+  start_x = std::max(start_x, 0);
+  start_y = std::max(start_y, 0);
+  end_x = std::min(end_x, (s32)kMapExtent - 1);
+  end_y = std::min(end_y, (s32)kMapExtent - 1);
+
+  if (start_x > end_x || start_y > end_y) return 0;
+
+  const u32* top = &solid_sums_[(std::size_t)start_y * kSumsStride];
+  const u32* bottom = &solid_sums_[(std::size_t)(end_y + 1) * kSumsStride];
+
+  return bottom[end_x + 1] - bottom[start_x] - top[end_x + 1] + top[start_x];
 }
 
 bool Map::IsSolid(TileId id) const {
   if (id == 0) return false;
-  if (id >= 162 && id <= 169) return false;  // treat doors as non-solid
+  if (id >= kFirstDoorTileId && id < kFirstDoorTileId + kDoorGroupCount) {
+    // Doors are only solid while their group is closed.
+    return (closed_doors_ >> (id - kFirstDoorTileId)) & 1;
+  }
   if (id < 170) return true;
   if (id >= 192 && id <= 240) return true;
   if (id >= 242 && id <= 252) return true;
@@ -124,18 +650,8 @@ TileId Map::GetTileId(const Vector2f& position) const {
 bool Map::CanOccupy(u16 position_x, u16 position_y, float radius) const {
   int radius_check = (int)(radius + 0.5f);
 
-  for (int y = -radius_check; y <= radius_check; ++y) {
-    for (int x = -radius_check; x <= radius_check; ++x) {
-      uint16_t world_x = (uint16_t)(position_x + x);
-      uint16_t world_y = (uint16_t)(position_y + y);
-
-      if (IsSolid(world_x, world_y)) {
-        return false;
-      }
-    }
-  }
-
-  return true;
+  return !IsSolidRect(position_x - radius_check, position_y - radius_check, position_x + radius_check,
+                      position_y + radius_check);
 }
 
 bool Map::CanTraverse(const Vector2f& start, const Vector2f& end, float radius) const {
@@ -224,16 +740,7 @@ OccupyRect Map::GetClosestOccupyRect(Vector2f position, float radius, Vector2f p
 
       if (dir_x == 0) continue;
 
-      bool can_fit = true;
-
-      for (s16 y = check_y; std::abs(y - check_y) <= d && can_fit; y += dir_y) {
-        for (s16 x = check_x; std::abs(x - check_x) <= d; x += dir_x) {
-          if (IsSolid(x, y)) {
-            can_fit = false;
-            break;
-          }
-        }
-      }
+      bool can_fit = CanFitBox(*this, check_x, check_y, dir_x, dir_y, d);
 
       if (can_fit) {
         u16 found_start_x = 0;
@@ -329,16 +836,7 @@ Vector2f Map::GetOccupyCenter(const Vector2f& position, float radius) const {
 
       if (dir_x == 0) continue;
 
-      bool can_fit = true;
-
-      for (s16 y = check_y; std::abs(y - check_y) <= d && can_fit; y += dir_y) {
-        for (s16 x = check_x; std::abs(x - check_x) <= d; x += dir_x) {
-          if (IsSolid(x, y)) {
-            can_fit = false;
-            break;
-          }
-        }
-      }
+      bool can_fit = CanFitBox(*this, check_x, check_y, dir_x, dir_y, d);
 
       if (can_fit) {
         // Calculate the final region. Not necessary for simple overlap check, but might be useful
@@ -419,16 +917,7 @@ size_t Map::GetAllOccupiedRects(Vector2f position, float radius, OccupiedRect* r
 
       if (dir_x == 0) continue;
 
-      bool can_fit = true;
-
-      for (s16 y = check_y; std::abs(y - check_y) <= d && can_fit; y += dir_y) {
-        for (s16 x = check_x; std::abs(x - check_x) <= d; x += dir_x) {
-          if (IsSolid(x, y)) {
-            can_fit = false;
-            break;
-          }
-        }
-      }
+      bool can_fit = CanFitBox(*this, check_x, check_y, dir_x, dir_y, d);
 
       if (can_fit) {
         // Calculate the final region. Not necessary for simple overlap check, but might be useful
@@ -510,16 +999,7 @@ OccupyRect Map::GetPossibleOccupyRect(const Vector2f& position, float radius) co
 
       if (dir_x == 0) continue;
 
-      bool can_fit = true;
-
-      for (s16 y = check_y; std::abs(y - check_y) <= d && can_fit; y += dir_y) {
-        for (s16 x = check_x; std::abs(x - check_x) <= d; x += dir_x) {
-          if (IsSolid(x, y)) {
-            can_fit = false;
-            break;
-          }
-        }
-      }
+      bool can_fit = CanFitBox(*this, check_x, check_y, dir_x, dir_y, d);
 
       if (can_fit) {
         // Calculate the final region. Not necessary for simple overlap check, but might be useful
@@ -590,16 +1070,7 @@ bool Map::CanOverlapTile(const Vector2f& position, float radius) const {
 
       if (dir_x == 0) continue;
 
-      bool can_fit = true;
-
-      for (s16 y = check_y; std::abs(y - check_y) <= d && can_fit; y += dir_y) {
-        for (s16 x = check_x; std::abs(x - check_x) <= d; x += dir_x) {
-          if (IsSolid(x, y)) {
-            can_fit = false;
-            break;
-          }
-        }
-      }
+      bool can_fit = CanFitBox(*this, check_x, check_y, dir_x, dir_y, d);
 
       if (can_fit) {
 #if 0
@@ -685,16 +1156,12 @@ bool Map::CanOccupy(const Vector2f& position, float radius) const {
 
   radius = std::floor(radius + 0.5f);
 
-  for (float y = -radius; y <= radius; ++y) {
-    for (float x = -radius; x <= radius; ++x) {
-      uint16_t world_x = (uint16_t)(position.x + x);
-      uint16_t world_y = (uint16_t)(position.y + y);
-      if (IsSolid(world_x, world_y)) {
-        return false;
-      }
-    }
-  }
-  return true;
+  s32 start_x = (s32)(position.x - radius);
+  s32 start_y = (s32)(position.y - radius);
+  s32 end_x = (s32)(position.x + radius);
+  s32 end_y = (s32)(position.y + radius);
+
+  return !IsSolidRect(start_x, start_y, end_x, end_y);
 #endif
 }
 
@@ -702,30 +1169,175 @@ std::vector<const elvl::Region*> Map::GetRegions(Vector2f position) const {
   return GetRegions((u16)position.x, (u16)position.y);
 }
 
-bool Map::InRegion(std::string name, Vector2f position) const {
+bool Map::InRegion(const std::string& name, Vector2f position) const {
   return InRegion(name, (u16)position.x, (u16)position.y);
 }
 
+bool Map::InRegion(RegionHandle handle, Vector2f position) const {
+  return InRegion(handle, (u16)position.x, (u16)position.y);
+}
+
 std::vector<const elvl::Region*> Map::GetRegions(u16 x, u16 y) const {
-  std::vector<const elvl::Region*> result;
+  if (x > 1023 || y > 1023 || tile_region_sets_.empty()) return {};
 
-  for (auto& region : regions) {
-    if (region.InRegion(x, y)) {
-      result.push_back(&region);
-    }
-  }
+  return region_sets_[tile_region_sets_[(std::size_t)y * kMapExtent + x]];
+}
 
-  return result;
+size_t Map::GetRegions(u16 x, u16 y, std::span<const elvl::Region*> regions) const {
+  if (x > 1023 || y > 1023 || tile_region_sets_.empty()) return 0;
+
+  const auto& set = region_sets_[tile_region_sets_[(std::size_t)y * kMapExtent + x]];
+  size_t count = std::min(set.size(), regions.size());
+
+  std::copy_n(set.begin(), count, regions.begin());
+
+  return set.size();
 }
 
-bool Map::InRegion(std::string name, u16 x, u16 y) const {
+RegionHandle Map::GetRegionHandle(const std::string& name) const {
+  RegionHandle handle;
+
   auto iter = region_map.find(name);
 
-  if (iter == region_map.end()) return false;
+  if (iter != region_map.end()) {
+    handle.index = (u16)(iter->second - regions.data());
+  }
+
+  return handle;
+}
+
+const elvl::Region* Map::GetRegion(RegionHandle handle) const {
+  if (!handle.IsValid() || handle.index >= regions.size()) return nullptr;
+
+  return &regions[handle.index];
+}
+
+bool Map::InRegion(const std::string& name, u16 x, u16 y) const {
+  return InRegion(GetRegionHandle(name), x, y);
+}
+
+bool Map::InRegion(RegionHandle handle, u16 x, u16 y) const {
+  const elvl::Region* region = GetRegion(handle);
+
+  if (!region) return false;
+  if (x > 1023 || y > 1023) return false;
 
-  return iter->second->InRegion(x, y);
+  const auto& set = region_sets_[tile_region_sets_[(std::size_t)y * kMapExtent + x]];
+
+  return std::find(set.begin(), set.end(), region) != set.end();
 }
 
+namespace elvl {
+
+// The tiles of one region while it's being decoded. Each row is stored in kSolidRowWords words.
+struct RegionBitmap {
+  static constexpr std::size_t kTileCount = kMapExtent * kMapExtent;
+  static constexpr std::size_t kWordCount = kTileCount / 64;
+
+  u64 tiles[kWordCount];
+
+  void Clear() { memset(tiles, 0, sizeof(tiles)); }
+
+  // Sets a run of tiles starting at the tile index. A run that goes past the end of a row continues on the next row.
+  inline void SetRun(std::size_t index, std::size_t count) {
+    std::size_t end = index + count;
+
+    if (end > kTileCount) end = kTileCount;
+
+    while (index < end) {
+      std::size_t bit = index & 63;
+      std::size_t bits = 64 - bit;
+
+      if (bits > end - index) bits = end - index;
+
+      u64 mask = bits == 64 ? ~0ULL : ((1ULL << bits) - 1);
+      tiles[index >> 6] |= mask << bit;
+
+      index += bits;
+    }
+  }
+
+  // Adds every tile in the source row to the count rows that start at dest_y.
+  inline void RepeatRow(s32 source_y, s32 dest_y, s32 count) {
+    if (source_y < 0 || source_y >= (s32)kMapExtent) return;
+
+    const u64* source = tiles + source_y * kSolidRowWords;
+
+    for (s32 y = dest_y; y < dest_y + count && y < (s32)kMapExtent; ++y) {
+      u64* dest = tiles + y * kSolidRowWords;
+
+      for (std::size_t i = 0; i < kSolidRowWords; ++i) {
+        dest[i] |= source[i];
+      }
+    }
+  }
+};
+
+// Assigns each tile the id of the combination of regions that contain it.
+// Regions are added in order, so a tile's set grows by one region at a time and the transitions can be cached.
+struct RegionSetBuilder {
+  std::vector<u16>& tile_sets;
+  std::vector<std::vector<u16>> sets;
+  // Maps (set id, region index) to the id of the set with the region added.
+  std::unordered_map<u64, u16> transitions;
+  // Set when there were more combinations of regions than the set ids can hold, so some tiles have the wrong set.
+  bool overflowed = false;
+
+  RegionSetBuilder(std::vector<u16>& tile_sets) : tile_sets(tile_sets), sets(1) {}
+
+  void Add(u16 region_index, const RegionBitmap& bitmap) {
+    if (tile_sets.empty()) {
+      tile_sets.resize(RegionBitmap::kTileCount, 0);
+    }
+
+    // Neighboring tiles usually share a set, so remember the last transition.
+    u16 last_from = 0xFFFF;
+    u16 last_to = 0;
+
+    for (std::size_t word = 0; word < RegionBitmap::kWordCount; ++word) {
+      u64 bits = bitmap.tiles[word];
+
+      while (bits) {
+        std::size_t index = word * 64 + std::countr_zero(bits);
+        bits &= bits - 1;
+
+        u16& set = tile_sets[index];
+
+        if (set != last_from) {
+          last_from = set;
+          last_to = GetTransition(set, region_index);
+        }
+
+        set = last_to;
+      }
+    }
+  }
+
+  u16 GetTransition(u16 from, u16 region_index) {
+    u64 key = ((u64)from << 16) | region_index;
+    auto iter = transitions.find(key);
+
+    if (iter != transitions.end()) return iter->second;
+
+    // The ids are stored in 16 bits, so tiles keep their current set if there are too many combinations.
+    if (sets.size() > 0xFFFF) {
+      overflowed = true;
+      return from;
+    }
+
+    std::vector<u16> set = sets[from];
+    set.push_back(region_index);
+
+    u16 id = (u16)sets.size();
+    sets.push_back(std::move(set));
+    transitions[key] = id;
+
+    return id;
+  }
+};
+
+}  // namespace elvl
+
 void Map::ParseRegions(const char* file_data) {
   using namespace elvl;
 
@@ -750,6 +1362,10 @@ void Map::ParseRegions(const char* file_data) {
     if (header->magic == kElvlMagicNumber) {
       u8* current = (u8*)(header + 1);
 
+      // Each region is decoded into the bitmap and then merged into the per-tile region sets.
+      auto bitmap = std::make_unique<RegionBitmap>();
+      RegionSetBuilder set_builder(tile_region_sets_);
+
       while (current < (u8*)header + header->totalsize) {
         ELvlChunkHeader* chunk_header = (ELvlChunkHeader*)current;
         current += sizeof(ELvlChunkHeader);
@@ -768,6 +1384,8 @@ void Map::ParseRegions(const char* file_data) {
             regions.emplace_back();
             Region& region = regions.back();
 
+            bitmap->Clear();
+
             // The current tile being processed for the run-length encoded data.
             int current_x = 0;
             int current_y = 0;
@@ -823,9 +1441,7 @@ void Map::ParseRegions(const char* file_data) {
                       case 2: {  // 1-32 Present tiles in a row
                         u8 run = (tile_ptr[0] & 0x1F) + 1;
 
-                        for (int i = 0; i < run; ++i) {
-                          region.SetTile(current_x + i, current_y);
-                        }
+                        bitmap->SetRun((std::size_t)current_y * kMapExtent + current_x, run);
 
                         current_x += run;
                         if (current_x >= 1024) {
@@ -838,9 +1454,7 @@ void Map::ParseRegions(const char* file_data) {
                       case 3: {  // 1-1024 Present tiles in a row
                         u16 run = (((tile_ptr[0] & 3) << 8) | tile_ptr[1]) + 1;
 
-                        for (int i = 0; i < run; ++i) {
-                          region.SetTile(current_x + i, current_y);
-                        }
+                        bitmap->SetRun((std::size_t)current_y * kMapExtent + current_x, run);
 
                         current_x += run;
                         if (current_x >= 1024) {
@@ -871,13 +1485,7 @@ void Map::ParseRegions(const char* file_data) {
 
                         current_x = 0;
 
-                        for (int i = 0; i < run; ++i) {
-                          for (int x = 0; x < 1024; ++x) {
-                            if (region.InRegion(x, current_y - 1)) {
-                              region.SetTile(x, current_y + i);
-                            }
-                          }
-                        }
+                        bitmap->RepeatRow(current_y - 1, current_y, run);
 
                         current_y += run;
 
@@ -888,13 +1496,7 @@ void Map::ParseRegions(const char* file_data) {
 
                         current_x = 0;
 
-                        for (int i = 0; i < run; ++i) {
-                          for (int x = 0; x < 1024; ++x) {
-                            if (region.InRegion(x, current_y - 1)) {
-                              region.SetTile(x, current_y + i);
-                            }
-                          }
-                        }
+                        bitmap->RepeatRow(current_y - 1, current_y, run);
 
                         current_y += run;
 
@@ -930,6 +1532,8 @@ void Map::ParseRegions(const char* file_data) {
               // Align the pointer to 4 byte boundary.
               sub_data += (subchunk->size + 3) & ~3;
             }
+
+            set_builder.Add((u16)(regions.size() - 1), *bitmap);
           } break;
           case 'TEST': {
             // Tileset data
@@ -946,6 +1550,25 @@ void Map::ParseRegions(const char* file_data) {
         // Align the pointer to 4 byte boundary.
         current += (chunk_header->size + 3) & ~3;
       }
+
+      // Tiles would be missing some of their regions, so none of the region data is used rather than giving wrong
+      // answers.
+      if (set_builder.overflowed) {
+        fprintf(stderr, "Map has more than %d combinations of overlapping regions, so its regions aren't loaded.\n",
+                0xFFFF);
+        tile_region_sets_.clear();
+        regions.clear();
+        return;
+      }
+
+      // The regions are done being added, so the sets can point at them now.
+      region_sets_.resize(set_builder.sets.size());
+
+      for (std::size_t i = 0; i < set_builder.sets.size(); ++i) {
+        for (u16 region_index : set_builder.sets[i]) {
+          region_sets_[i].push_back(&regions[region_index]);
+        }
+      }
     }
 
     // Create a mapping from names to region data.
@@ -962,29 +1585,25 @@ struct Tile {
 };
 
 std::unique_ptr<Map> Map::Load(const char* filename) {
-  std::ifstream input(filename, std::ios::in | std::ios::binary);
-
-  if (!input.is_open()) return nullptr;
-
-  input.seekg(0, std::ios::end);
-  std::size_t size = static_cast<std::size_t>(input.tellg());
-  input.seekg(0, std::ios::beg);
+  // The file is mapped so the tile records and region data are read in place instead of through a copy.
+  MappedFile file;
 
-  std::string data;
-  data.resize(size);
-
-  input.read(&data[0], size);
+  if (!file.Open(filename)) return nullptr;
 
+  const u8* data = file.GetData();
+  std::size_t size = file.GetSize();
   std::size_t pos = 0;
 
-  if (data[0] == 'B' && data[1] == 'M') {
+  // Skip over the bitmap that can prefix the tile data. Its size is stored in the bitmap header.
+  if (size >= 6 && data[0] == 'B' && data[1] == 'M') {
     pos = *(u32*)(&data[2]);
   }
 
   TileData tiles(kMapExtent * kMapExtent);
 
-  while (pos < size) {
-    Tile tile = *reinterpret_cast<Tile*>(&data[pos]);
+  while (pos + sizeof(Tile) <= size) {
+    Tile tile;
+    memcpy(&tile, data + pos, sizeof(Tile));
 
     tiles[tile.y * kMapExtent + tile.x] = tile.tile;
 
@@ -1014,9 +1633,12 @@ std::unique_ptr<Map> Map::Load(const char* filename) {
     pos += sizeof(Tile);
   }
 
-  auto map = std::make_unique<Map>(tiles);
+  auto map = std::make_unique<Map>(std::move(tiles));
 
-  map->ParseRegions(data.data());
+  // The elvl offset is stored in the bitmap header, so there can't be any region data without it.
+  if (size >= 10) {
+    map->ParseRegions((const char*)data);
+  }
 
   return map;
 }
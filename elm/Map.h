@@ -5,7 +5,10 @@
 #include <elm/Types.h>
 
 #include <bitset>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <span>
 #include <string>
 #include <string_view>
 #include <unordered_map>
@@ -14,12 +17,69 @@
 namespace elm {
 
 constexpr std::size_t kMapExtent = 1024;
+// Number of 64-bit words needed to store one row of a tile bitmap.
+constexpr std::size_t kSolidRowWords = kMapExtent / 64;
+
+// Returns true if any bit in the inclusive span [start_x, end_x] of a bitmap row is set.
+// The span must already be within the row.
+inline bool TestRowSpan(const u64* row, s32 start_x, s32 end_x) {
+  s32 first_word = start_x >> 6;
+  s32 last_word = end_x >> 6;
+
+  u64 first_mask = ~0ULL << (start_x & 63);
+  u64 last_mask = ~0ULL >> (63 - (end_x & 63));
+
+  if (first_word == last_word) {
+    return (row[first_word] & first_mask & last_mask) != 0;
+  }
+
+  if (row[first_word] & first_mask) return true;
+
+  for (s32 word = first_word + 1; word < last_word; ++word) {
+    if (row[word]) return true;
+  }
+
+  return (row[last_word] & last_mask) != 0;
+}
 
 using TileId = u8;
 using TileData = std::vector<TileId>;
 
 constexpr TileId kSafeTileId = 171;
 
+// Door tiles are grouped by their tile id. Each group opens and closes together.
+constexpr TileId kFirstDoorTileId = 162;
+constexpr std::size_t kDoorGroupCount = 8;
+
+// Inclusive rect of tiles.
+struct MapRect {
+  s32 start_x;
+  s32 start_y;
+  s32 end_x;
+  s32 end_y;
+
+  MapRect() : start_x(0), start_y(0), end_x(-1), end_y(-1) {}
+  MapRect(s32 start_x, s32 start_y, s32 end_x, s32 end_y)
+      : start_x(start_x), start_y(start_y), end_x(end_x), end_y(end_y) {}
+
+  inline bool IsEmpty() const { return end_x < start_x || end_y < start_y; }
+  inline bool Contains(s32 x, s32 y) const { return x >= start_x && x <= end_x && y >= start_y && y <= end_y; }
+
+  // Returns the rect grown by the amount on every side and clamped to the map.
+  inline MapRect Expand(s32 amount) const { return Expand(amount, amount, amount, amount); }
+
+  inline MapRect Expand(s32 left, s32 top, s32 right, s32 bottom) const {
+    MapRect result(start_x - left, start_y - top, end_x + right, end_y + bottom);
+
+    if (result.start_x < 0) result.start_x = 0;
+    if (result.start_y < 0) result.start_y = 0;
+    if (result.end_x > (s32)kMapExtent - 1) result.end_x = (s32)kMapExtent - 1;
+    if (result.end_y > (s32)kMapExtent - 1) result.end_y = (s32)kMapExtent - 1;
+
+    return result;
+  }
+};
+
 struct OccupyRect {
   bool occupy;
 
@@ -66,23 +126,43 @@ using RegionFlags = u32;
 struct Region {
   std::string name;
   RegionFlags flags = 0;
+};
 
-  // If a tile is part of this region then it will be set in this bitset.
-  std::bitset<1024 * 1024> tiles;
+}  // namespace elvl
 
-  inline void SetTile(u16 x, u16 y) { tiles.set(y * 1024 + x); }
+// Resolved reference to one of a map's regions.
+// Checking a region through its handle skips the name lookup, so it doesn't allocate or hash anything.
+struct RegionHandle {
+  u16 index = 0xFFFF;
 
-  inline bool InRegion(u16 x, u16 y) const {
-    if (x > 1023 || y > 1023) return false;
-    return tiles.test(y * 1024 + x);
-  }
+  inline bool IsValid() const { return index != 0xFFFF; }
 };
 
-}  // namespace elvl
+struct TileChange {
+  u16 x;
+  u16 y;
+  TileId id;
+};
+
+class OccupancyLayer;
+class Map;
+
+enum class TileChangeType {
+  // The tiles changed solidity. The map's own derived data is already updated for them.
+  Solidity,
+  // The tiles kept their solidity but changed between safe and unsafe, so only data derived from the tile ids changes.
+  Safe,
+};
+
+// Called after tiles change with the rects of tiles that changed. The map's own derived data is already updated when
+// this is called, so listeners can use it to update their own data in the rects.
+using ChangeListener = std::function<void(const Map& map, std::span<const MapRect> changed, TileChangeType type)>;
 
 class Map {
  public:
-  Map(const TileData& tile_data);
+  // The tile data is moved in when possible so loading doesn't need a second copy of the grid.
+  Map(TileData tile_data);
+  ~Map();
 
   bool IsSolid(TileId id) const;
   bool IsSolid(u16 x, u16 y) const;
@@ -90,6 +170,20 @@ class Map {
   TileId GetTileId(u16 x, u16 y) const;
   TileId GetTileId(const Vector2f& position) const;
 
+  // Returns true if any tile in the inclusive span [start_x, end_x] of row y is solid.
+  // Tiles outside of the map are treated as solid.
+  bool IsSolidRow(s32 y, s32 start_x, s32 end_x) const;
+  // Returns true if any tile in the inclusive rect is solid. Tiles outside of the map are treated as solid.
+  // This is constant time because it uses the summed-area table.
+  bool IsSolidRect(s32 start_x, s32 start_y, s32 end_x, s32 end_y) const;
+  // Returns the number of solid tiles in the inclusive rect. The rect is clamped to the map.
+  u32 GetSolidCount(s32 start_x, s32 start_y, s32 end_x, s32 end_y) const;
+
+  // Returns the squared distance from the tile to the closest solid tile. Tiles outside of the map count as solid.
+  u32 GetWallDistanceSq(u16 x, u16 y) const;
+  // Returns the distance from the tile to the closest solid tile. Tiles outside of the map count as solid.
+  float GetWallDistance(u16 x, u16 y) const;
+
   bool CanOccupy(u16 x, u16 y, float radius) const;
   bool CanOccupy(const Vector2f& position, float radius) const;
 
@@ -108,22 +202,105 @@ class Map {
 
   OccupyRect GetClosestOccupyRect(Vector2f position, float radius, Vector2f point) const;
 
+  // Returns a hash of the tile data. This is used to tell if precomputed data was created for the same map.
+  u64 GetTileHash() const;
+
+  // Returns the precomputed occupancy data for the radius. It is created on first use and shared by everything that
+  // requests the same radius.
+  const OccupancyLayer& GetOccupancyLayer(float radius) const;
+
   std::vector<const elvl::Region*> GetRegions(Vector2f position) const;
   std::vector<const elvl::Region*> GetRegions(u16 x, u16 y) const;
-
-  bool InRegion(std::string name, Vector2f position) const;
-  bool InRegion(std::string name, u16 x, u16 y) const;
+  // Writes the regions that contain the tile into the span and returns the number of regions that contain it.
+  // Only the regions that fit are written, so a result larger than the span means the span was too small.
+  size_t GetRegions(u16 x, u16 y, std::span<const elvl::Region*> regions) const;
+
+  // Returns an invalid handle if the map doesn't have a region with the name.
+  RegionHandle GetRegionHandle(const std::string& name) const;
+  const elvl::Region* GetRegion(RegionHandle handle) const;
+
+  bool InRegion(const std::string& name, Vector2f position) const;
+  bool InRegion(const std::string& name, u16 x, u16 y) const;
+  bool InRegion(RegionHandle handle, Vector2f position) const;
+  bool InRegion(RegionHandle handle, u16 x, u16 y) const;
+
+  // Door state is one bit per door group, starting at kFirstDoorTileId. A set bit means the group is closed and its
+  // tiles are solid. Every door starts open.
+  // Changing the door state updates the map's own derived data and returns the rects of tiles that changed solidity.
+  // Pathfinder::UpdateMapWeights and RegionRegistry::Update take these rects to update only the affected area.
+  u8 GetDoorState() const { return closed_doors_; }
+  std::vector<MapRect> SetDoorState(u8 closed_doors);
+  std::vector<MapRect> SetDoorOpen(TileId door_id, bool open);
+
+  void SeedDoors(u32 seed) { door_seed_ = seed; }
+  // Advances the door generator and applies the next state for the DoorMode arena setting.
+  // Zero or positive modes are a fixed door state, -1 closes higher door ids more often, -2 is completely random.
+  std::vector<MapRect> UpdateDoors(s32 door_mode);
+
+  // Replaces the tile and updates the derived data around it. This is used for bricks and other runtime tile changes.
+  // Only tiles that change solidity are included in the returned rects. Tiles that only change between safe and unsafe
+  // are reported to the listeners as TileChangeType::Safe.
+  std::vector<MapRect> SetTile(u16 x, u16 y, TileId id);
+  // Replaces every tile in the list with one update, so changes that are close together share their work.
+  std::vector<MapRect> SetTiles(std::span<const TileChange> changes);
+
+  // Listeners are called for every change to solidity, including door changes, and for tiles changing between safe and
+  // unsafe. Returns an id for removing it.
+  std::size_t AddChangeListener(ChangeListener listener);
+  void RemoveChangeListener(std::size_t id);
 
   static std::unique_ptr<Map> Load(const char* filename);
   static std::unique_ptr<Map> Load(const std::string& filename);
 
  private:
   TileData tile_data_;
+  // One bit per tile that is set if the tile is solid. This is used for checking 64 tiles at once.
+  std::vector<u64> solid_bits_;
+  // Summed-area table of solid tiles with an extra zero row and column at the top-left.
+  // The value at (x + 1, y + 1) is the number of solid tiles in the rect from (0, 0) to (x, y).
+  std::vector<u32> solid_sums_;
+  // Squared euclidean distance from each tile to the closest solid tile.
+  std::vector<u32> wall_distance_sq_;
+  // Distance along each column to the closest solid tile. This is kept so a tile change only redoes its own column.
+  std::vector<u16> wall_column_distance_;
+
+  // Tile indexes of every door tile in each door group.
+  std::vector<u32> door_tiles_[kDoorGroupCount];
+  u8 closed_doors_ = 0;
+  u32 door_seed_ = 0;
+
+  std::vector<std::pair<std::size_t, ChangeListener>> change_listeners_;
+  std::size_t next_listener_id_ = 0;
+
+  mutable std::mutex occupancy_mutex_;
+  mutable std::vector<std::unique_ptr<OccupancyLayer>> occupancy_layers_;
   std::vector<elvl::Region> regions;
 
   std::unordered_map<std::string, elvl::Region*> region_map;
 
+  // Id of the region combination that contains each tile. This is empty if the map has no regions.
+  std::vector<u16> tile_region_sets_;
+  // Every unique combination of regions that contains a tile. Set zero is the empty set.
+  std::vector<std::vector<const elvl::Region*>> region_sets_;
+
   void ParseRegions(const char* file_data);
+  void BuildWallDistanceField();
+
+  struct WallColumnChange {
+    s32 x;
+    s32 y;
+    u16 old_distance;
+  };
+
+  // Rebuilds the column distances of the column. Each distance that changed is added to changes if it's not null.
+  void BuildWallColumnDistance(s32 x, std::vector<WallColumnChange>* changes);
+  void BuildWallDistanceRow(s32 y);
+  // Updates the wall distances in a row after some of its column distances changed. The changes must be in the row.
+  void UpdateWallDistanceRow(s32 y, const WallColumnChange* changes, std::size_t count);
+
+  // Updates the derived solid data after the tiles at the indexes changed solidity and returns the changed rects.
+  // Every index must be unique and its tile must have changed solidity.
+  std::vector<MapRect> UpdateSolidTiles(const std::vector<u32>& indexes);
 };
 
 }  // namespace elm
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <elm/Types.h>
+
+#include <cstddef>
+
+namespace elm {
+
+// Read-only view of a whole file mapped into memory.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Maps the file and returns true if it was opened. Any previously mapped file is closed first.
+  bool Open(const char* filename);
+  void Close();
+
+  inline bool IsOpen() const { return data_ != nullptr; }
+  inline const u8* GetData() const { return data_; }
+  inline size_t GetSize() const { return size_; }
+
+ private:
+  const u8* data_ = nullptr;
+  size_t size_ = 0;
+
+#ifdef _WIN32
+  void* file_handle_ = nullptr;
+  void* mapping_handle_ = nullptr;
+#endif
+};
+
+}  // namespace elm
@@ -0,0 +1,257 @@
+#include "NavCache.h"
+
+#include <elm/Map.h>
+#include <elm/MappedFile.h>
+#include <elm/RegionRegistry.h>
+#include <elm/path/IncrementalSearch.h>
+#include <elm/path/Pathfinder.h>
+
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace elm {
+namespace nav_cache {
+
+constexpr u32 kMagic = 0x76616e65;  // "enav"
+// This must be incremented any time the file layout or the precomputed data changes.
+constexpr u32 kVersion = 4;
+
+constexpr size_t kNodeCount = 1024 * 1024;
+static_assert(sizeof(path::EdgeSet) == sizeof(u8), "Edge sets are stored as one byte per node.");
+constexpr u32 kCachedUndefinedRegion = 0xFFFFFFFF;
+
+// The file is the header followed by each section in the order of the counts here.
+struct Header {
+  u32 magic;
+  u32 version;
+  u64 tile_hash;
+  float ship_radius;
+  u32 linear_weights;
+
+  u32 region_count;
+  u32 diagonal_count;
+  u32 outside_edge_count;
+  u32 free_region_count;
+
+  u32 door_state;
+  u32 reserved;
+};
+
+// Only tiles with outside edge owners are stored.
+struct OutsideEdgeEntry {
+  u32 index;
+  u32 count;
+  u32 owners[SharedRegionOwnership::kMaxOwners];
+};
+
+struct DiagonalEntry {
+  u16 x;
+  u16 y;
+};
+
+// Sections are laid out from largest to smallest alignment so each one is aligned in the mapped file.
+struct Layout {
+  size_t weights;
+  size_t coord_regions;
+  size_t outside_edges;
+  size_t free_regions;
+  size_t diagonals;
+  size_t edges;
+  size_t traversable;
+  size_t size;
+
+  Layout(const Header& header) {
+    weights = sizeof(Header);
+    coord_regions = weights + kNodeCount * sizeof(float);
+    outside_edges = coord_regions + kNodeCount * sizeof(u32);
+    free_regions = outside_edges + header.outside_edge_count * sizeof(OutsideEdgeEntry);
+    diagonals = free_regions + header.free_region_count * sizeof(u32);
+    edges = diagonals + header.diagonal_count * sizeof(DiagonalEntry);
+    traversable = edges + kNodeCount * sizeof(u8);
+    size = traversable + kNodeCount * sizeof(u8);
+  }
+};
+
+static bool IsMatchingKey(const Header& header, const NavCacheKey& key) {
+  return header.magic == kMagic && header.version == kVersion && header.tile_hash == key.tile_hash &&
+         header.door_state == key.door_state && header.ship_radius == key.ship_radius &&
+         header.linear_weights == (u32)key.linear_weights;
+}
+
+bool Load(const char* filename, const NavCacheKey& key, path::Pathfinder& pathfinder, RegionRegistry& registry) {
+  MappedFile file;
+
+  if (!file.Open(filename)) return false;
+  if (file.GetSize() < sizeof(Header)) return false;
+
+  const u8* data = file.GetData();
+  const Header& header = *(const Header*)data;
+
+  if (!IsMatchingKey(header, key)) return false;
+
+  Layout layout(header);
+
+  if (file.GetSize() != layout.size) return false;
+
+  const OutsideEdgeEntry* outside_edges = (const OutsideEdgeEntry*)(data + layout.outside_edges);
+  const u32* free_regions = (const u32*)(data + layout.free_regions);
+  const u32* coord_regions = (const u32*)(data + layout.coord_regions);
+
+  // The entries index into fixed size arrays and the regions index into the registry's regions, so a damaged file is
+  // rejected before anything is loaded from it.
+  for (u32 i = 0; i < header.outside_edge_count; ++i) {
+    const OutsideEdgeEntry& entry = outside_edges[i];
+
+    if (entry.index >= kNodeCount || entry.count > SharedRegionOwnership::kMaxOwners) return false;
+
+    for (u32 j = 0; j < entry.count; ++j) {
+      if (entry.owners[j] >= header.region_count) return false;
+    }
+  }
+
+  for (u32 i = 0; i < header.free_region_count; ++i) {
+    if (free_regions[i] >= header.region_count) return false;
+  }
+
+  for (size_t i = 0; i < kNodeCount; ++i) {
+    if (coord_regions[i] != kCachedUndefinedRegion && coord_regions[i] >= header.region_count) return false;
+  }
+
+  path::NavGraph& graph = pathfinder.processor_->GetGraph();
+
+  memcpy(graph.weights.data(), data + layout.weights, kNodeCount * sizeof(float));
+  memcpy(graph.edges.data(), data + layout.edges, kNodeCount * sizeof(u8));
+  memcpy(graph.traversable.data(), data + layout.traversable, kNodeCount * sizeof(u8));
+
+  const DiagonalEntry* diagonals = (const DiagonalEntry*)(data + layout.diagonals);
+
+  pathfinder.debug_diagonals_.clear();
+  pathfinder.debug_diagonals_.reserve(header.diagonal_count);
+
+  for (u32 i = 0; i < header.diagonal_count; ++i) {
+    pathfinder.debug_diagonals_.push_back(Vector2f(diagonals[i].x, diagonals[i].y));
+  }
+
+  for (size_t i = 0; i < kNodeCount; ++i) {
+    u32 region = coord_regions[i];
+    registry.coord_regions_[i] = region == kCachedUndefinedRegion ? kUndefinedRegion : region;
+  }
+
+  for (size_t i = 0; i < kNodeCount; ++i) {
+    registry.outside_edges_[i].count = 0;
+  }
+
+  for (u32 i = 0; i < header.outside_edge_count; ++i) {
+    const OutsideEdgeEntry& entry = outside_edges[i];
+    SharedRegionOwnership& ownership = registry.outside_edges_[entry.index];
+
+    for (u32 j = 0; j < entry.count; ++j) {
+      ownership.AddOwner(entry.owners[j]);
+    }
+  }
+
+  registry.region_count_ = header.region_count;
+  registry.free_regions_.assign(free_regions, free_regions + header.free_region_count);
+  registry.radius_ = key.ship_radius;
+
+  pathfinder.ship_radius_ = key.ship_radius;
+  pathfinder.linear_weights_ = key.linear_weights;
+
+  // The jump distances and cluster graph aren't cached, so rebuild them from the loaded graph.
+  if (pathfinder.jump_point_search_) {
+    pathfinder.SetJumpPointSearch(true);
+  }
+
+  if (pathfinder.cluster_graph_) {
+    pathfinder.SetHierarchicalSearch(true);
+  }
+
+  // The landmarks aren't cached either, but they take seconds to build, so they're left for UpdateLandmarks.
+  if (pathfinder.landmarks_) {
+    pathfinder.landmarks_->Invalidate();
+  }
+
+  // The incremental tree was searched over the old graph.
+  if (pathfinder.incremental_search_) {
+    pathfinder.incremental_search_->Reset();
+  }
+
+  return true;
+}
+
+bool Save(const char* filename, const NavCacheKey& key, const path::Pathfinder& pathfinder,
+          const RegionRegistry& registry) {
+  const path::NavGraph& graph = pathfinder.processor_->GetGraph();
+
+  std::vector<u32> coord_regions(kNodeCount);
+  std::vector<OutsideEdgeEntry> outside_edges;
+  std::vector<DiagonalEntry> diagonals;
+
+  for (size_t i = 0; i < kNodeCount; ++i) {
+    RegionIndex region = registry.coord_regions_[i];
+    coord_regions[i] = region == kUndefinedRegion ? kCachedUndefinedRegion : (u32)region;
+
+    const SharedRegionOwnership& ownership = registry.outside_edges_[i];
+
+    if (ownership.count > 0) {
+      OutsideEdgeEntry entry = {};
+
+      entry.index = (u32)i;
+      entry.count = (u32)ownership.count;
+
+      for (size_t j = 0; j < ownership.count; ++j) {
+        entry.owners[j] = (u32)ownership.owners[j];
+      }
+
+      outside_edges.push_back(entry);
+    }
+  }
+
+  for (const Vector2f& diagonal : pathfinder.debug_diagonals_) {
+    diagonals.push_back({(u16)diagonal.x, (u16)diagonal.y});
+  }
+
+  Header header = {};
+
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.tile_hash = key.tile_hash;
+  header.door_state = key.door_state;
+  header.ship_radius = key.ship_radius;
+  header.linear_weights = key.linear_weights;
+  header.region_count = (u32)registry.region_count_;
+  header.diagonal_count = (u32)diagonals.size();
+  header.outside_edge_count = (u32)outside_edges.size();
+  header.free_region_count = (u32)registry.free_regions_.size();
+
+  std::ofstream output(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+  if (!output.is_open()) return false;
+
+  output.write((const char*)&header, sizeof(header));
+  output.write((const char*)graph.weights.data(), kNodeCount * sizeof(float));
+  output.write((const char*)coord_regions.data(), kNodeCount * sizeof(u32));
+  output.write((const char*)outside_edges.data(), outside_edges.size() * sizeof(OutsideEdgeEntry));
+
+  for (RegionIndex region : registry.free_regions_) {
+    u32 free_region = (u32)region;
+    output.write((const char*)&free_region, sizeof(free_region));
+  }
+
+  output.write((const char*)diagonals.data(), diagonals.size() * sizeof(DiagonalEntry));
+  output.write((const char*)graph.edges.data(), kNodeCount * sizeof(u8));
+  output.write((const char*)graph.traversable.data(), kNodeCount * sizeof(u8));
+
+  return output.good();
+}
+
+}  // namespace nav_cache
+
+NavCacheKey::NavCacheKey(const Map& map, float ship_radius, bool linear_weights)
+    : tile_hash(map.GetTileHash()),
+      door_state(map.GetDoorState()),
+      ship_radius(ship_radius),
+      linear_weights(linear_weights) {}
+
+}  // namespace elm
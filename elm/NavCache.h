@@ -0,0 +1,36 @@
+#pragma once
+
+#include <elm/Types.h>
+
+namespace elm {
+
+class Map;
+class RegionRegistry;
+
+namespace path {
+struct Pathfinder;
+}  // namespace path
+
+// Identifies the settings that precomputed navigation data was created with.
+struct NavCacheKey {
+  u64 tile_hash;
+  // The tile ids don't say which doors are closed, so the door state is part of the key.
+  u8 door_state;
+  float ship_radius;
+  bool linear_weights;
+
+  NavCacheKey(const Map& map, float ship_radius, bool linear_weights);
+};
+
+// Binary file that stores the output of Pathfinder::CreateMapWeights and RegionRegistry::CreateAll so they can be
+// skipped when the same map is loaded again with the same settings.
+namespace nav_cache {
+
+// Loads the cached data into the pathfinder and registry. Returns false if the file doesn't exist, is from another
+// version, or was created with a different key. Nothing is modified when this fails.
+bool Load(const char* filename, const NavCacheKey& key, path::Pathfinder& pathfinder, RegionRegistry& registry);
+bool Save(const char* filename, const NavCacheKey& key, const path::Pathfinder& pathfinder,
+          const RegionRegistry& registry);
+
+}  // namespace nav_cache
+}  // namespace elm
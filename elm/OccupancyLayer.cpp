@@ -0,0 +1,218 @@
+#include "OccupancyLayer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace elm {
+
+OccupancyLayer::OccupancyLayer(const Map& map, float radius)
+    : map_(map),
+      radius_(radius),
+      diameter_((u16)(radius * 2.0f)),
+      occupy_radius_((s32)std::floor(radius + 0.5f)),
+      fit_bits_(kSolidRowWords * kMapExtent),
+      overlap_bits_(kSolidRowWords * kMapExtent),
+      occupy_bits_(kSolidRowWords * kMapExtent) {
+  MapRect full(0, 0, (s32)kMapExtent - 1, (s32)kMapExtent - 1);
+
+  BuildFit(full);
+  BuildOverlap(full);
+}
+
+void OccupancyLayer::Update(const MapRect& changed) {
+  s32 d = diameter_;
+
+  // Boxes that contain a changed tile start up to d tiles up and to the left of it.
+  BuildFit(changed.Expand(d, d, 0, 0));
+  // A changed fit can affect the overlap of tiles d away on either side, and the occupy square spans the radius.
+  BuildOverlap(changed.Expand(GetInfluence()));
+}
+
+s32 OccupancyLayer::GetInfluence() const { return std::max((s32)diameter_, occupy_radius_); }
+
+void OccupancyLayer::BuildFit(const MapRect& rect) {
+  s32 d = diameter_;
+
+  for (s32 y = rect.start_y; y <= rect.end_y; ++y) {
+    for (s32 x = rect.start_x; x <= rect.end_x; ++x) {
+      AssignBit(fit_bits_, (u16)x, (u16)y, !map_.IsSolidRect(x, y, x + d, y + d));
+    }
+  }
+}
+
+void OccupancyLayer::BuildOverlap(const MapRect& rect) {
+  s32 d = diameter_;
+  s32 occupy_radius = occupy_radius_;
+
+  for (s32 y = rect.start_y; y <= rect.end_y; ++y) {
+    for (s32 x = rect.start_x; x <= rect.end_x; ++x) {
+      if (map_.IsSolid((u16)x, (u16)y)) {
+        AssignBit(occupy_bits_, (u16)x, (u16)y, false);
+        AssignBit(overlap_bits_, (u16)x, (u16)y, false);
+        continue;
+      }
+
+      bool occupy = !map_.IsSolidRect(x - occupy_radius, y - occupy_radius, x + occupy_radius, y + occupy_radius);
+
+      AssignBit(occupy_bits_, (u16)x, (u16)y, occupy);
+
+      // Every box that contains this tile has its top-left corner within d tiles up and to the left of it.
+      bool overlap = d < 1;
+      s32 start_x = std::max(x - d, 0);
+
+      for (s32 start_y = std::max(y - d, 0); start_y <= y && !overlap; ++start_y) {
+        overlap = TestRowSpan(&fit_bits_[(std::size_t)start_y * kSolidRowWords], start_x, x);
+      }
+
+      AssignBit(overlap_bits_, (u16)x, (u16)y, overlap);
+    }
+  }
+}
+
+bool OccupancyLayer::CanTraverse(const Vector2f& start, const Vector2f& end) const {
+  if (!CanOverlapTile(start)) return false;
+  if (!CanOverlapTile(end)) return false;
+
+  Vector2f cross = Perpendicular(Normalize(start - end));
+
+  bool left_solid = map_.IsSolid(start + cross);
+  bool right_solid = map_.IsSolid(start - cross);
+
+  if (left_solid) {
+    for (float i = 0; i < radius_ * 2.0f; ++i) {
+      if (!CanOverlapTile(start - cross * i)) {
+        return false;
+      }
+
+      if (!CanOverlapTile(end - cross * i)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  if (right_solid) {
+    for (float i = 0; i < radius_ * 2.0f; ++i) {
+      if (!CanOverlapTile(start + cross * i)) {
+        return false;
+      }
+
+      if (!CanOverlapTile(end + cross * i)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  return true;
+}
+
+OccupyRect OccupancyLayer::GetPossibleOccupyRect(u16 x, u16 y) const {
+  OccupyRect result = {};
+  u16 d = diameter_;
+
+  bool solid = map_.IsSolid(x, y);
+  if (d < 1 || solid) {
+    result.occupy = !solid;
+    result.start_x = x;
+    result.start_y = y;
+    result.end_x = x;
+    result.end_y = y;
+
+    return result;
+  }
+
+  if (!CanOverlapTile(x, y)) return result;
+
+  u16 far_left = x - d;
+  u16 far_right = x + d;
+  u16 far_top = y - d;
+  u16 far_bottom = y + d;
+
+  // Handle wrapping that can occur from using unsigned short
+  if (far_left > 1023) far_left = 0;
+  if (far_right > 1023) far_right = 1023;
+  if (far_top > 1023) far_top = 0;
+  if (far_bottom > 1023) far_bottom = 1023;
+
+  // This visits the check tiles in the same order as Map::GetPossibleOccupyRect so the same rect is found.
+  for (u16 check_y = far_top; check_y <= far_bottom; ++check_y) {
+    if (check_y == y) continue;
+
+    u16 found_start_y = check_y > y ? check_y - d : check_y;
+
+    for (u16 check_x = far_left; check_x <= far_right; ++check_x) {
+      if (check_x == x) continue;
+
+      u16 found_start_x = check_x > x ? check_x - d : check_x;
+
+      if (CanFit(found_start_x, found_start_y)) {
+        result.start_x = found_start_x;
+        result.start_y = found_start_y;
+        result.end_x = found_start_x + d;
+        result.end_y = found_start_y + d;
+
+        result.occupy = true;
+        return result;
+      }
+    }
+  }
+
+  return result;
+}
+
+size_t OccupancyLayer::GetAllOccupiedRects(u16 x, u16 y, OccupiedRect* rects) const {
+  size_t count = 0;
+  u16 d = diameter_;
+
+  bool solid = map_.IsSolid(x, y);
+  if (d < 1 || solid) {
+    rects->start_x = x;
+    rects->start_y = y;
+    rects->end_x = x;
+    rects->end_y = y;
+
+    return !solid;
+  }
+
+  if (!CanOverlapTile(x, y)) return 0;
+
+  u16 far_left = x - d;
+  u16 far_right = x + d;
+  u16 far_top = y - d;
+  u16 far_bottom = y + d;
+
+  // Handle wrapping that can occur from using unsigned short
+  if (far_left > 1023) far_left = 0;
+  if (far_right > 1023) far_right = 1023;
+  if (far_top > 1023) far_top = 0;
+  if (far_bottom > 1023) far_bottom = 1023;
+
+  // This visits the check tiles in the same order as Map::GetAllOccupiedRects so the rects are in the same order.
+  for (u16 check_y = far_top; check_y <= far_bottom; ++check_y) {
+    if (check_y == y) continue;
+
+    u16 found_start_y = check_y > y ? check_y - d : check_y;
+
+    for (u16 check_x = far_left; check_x <= far_right; ++check_x) {
+      if (check_x == x) continue;
+
+      u16 found_start_x = check_x > x ? check_x - d : check_x;
+
+      if (CanFit(found_start_x, found_start_y)) {
+        OccupiedRect* rect = rects + count++;
+
+        rect->start_x = found_start_x;
+        rect->start_y = found_start_y;
+        rect->end_x = found_start_x + d;
+        rect->end_y = found_start_y + d;
+      }
+    }
+  }
+
+  return count;
+}
+
+}  // namespace elm
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <elm/Map.h>
+#include <elm/Math.h>
+#include <elm/Types.h>
+
+#include <vector>
+
+namespace elm {
+
+// Precomputed occupancy data for a single ship radius.
+// Every occupied rect for a radius is a (d + 1) x (d + 1) box, so storing which box positions are empty is enough to
+// rebuild the occupied rects of any tile without touching the tile data again.
+class OccupancyLayer {
+ public:
+  OccupancyLayer(const Map& map, float radius);
+
+  float GetRadius() const { return radius_; }
+  // The ship box spans this many tiles plus one on each axis.
+  u16 GetDiameter() const { return diameter_; }
+  // Returns how far from a changed tile the layer's bits can change.
+  s32 GetInfluence() const;
+
+  // Rebuilds the bits that depend on the tiles in the rect after their solidity changed.
+  void Update(const MapRect& changed);
+
+  // Returns true if the ship box that has its top-left corner at this tile is completely empty.
+  inline bool CanFit(s32 start_x, s32 start_y) const {
+    if (start_x < 0 || start_y < 0 || start_x >= 1024 || start_y >= 1024) return false;
+    return TestBit(fit_bits_, (u16)start_x, (u16)start_y);
+  }
+
+  // Same result as Map::CanOverlapTile with this layer's radius.
+  inline bool CanOverlapTile(u16 x, u16 y) const {
+    if (x >= 1024 || y >= 1024) return false;
+    return TestBit(overlap_bits_, x, y);
+  }
+
+  inline bool CanOverlapTile(const Vector2f& position) const {
+    return CanOverlapTile((u16)(s32)position.x, (u16)(s32)position.y);
+  }
+
+  // Same result as Map::CanOccupy with this layer's radius.
+  inline bool CanOccupy(u16 x, u16 y) const {
+    if (x >= 1024 || y >= 1024) return false;
+    return TestBit(occupy_bits_, x, y);
+  }
+
+  // Same result as Map::CanTraverse with this layer's radius.
+  bool CanTraverse(const Vector2f& start, const Vector2f& end) const;
+
+  // Same result as Map::GetPossibleOccupyRect with this layer's radius.
+  OccupyRect GetPossibleOccupyRect(u16 x, u16 y) const;
+
+  // Same result as Map::GetAllOccupiedRects with this layer's radius.
+  // Rects must be initialized memory that can contain all possible occupy rects.
+  size_t GetAllOccupiedRects(u16 x, u16 y, OccupiedRect* rects) const;
+
+ private:
+  inline static bool TestBit(const std::vector<u64>& bits, u16 x, u16 y) {
+    std::size_t index = (std::size_t)y * kMapExtent + x;
+    return (bits[index >> 6] >> (index & 63)) & 1;
+  }
+
+  inline static void AssignBit(std::vector<u64>& bits, u16 x, u16 y, bool value) {
+    std::size_t index = (std::size_t)y * kMapExtent + x;
+    u64 mask = 1ULL << (index & 63);
+
+    if (value) {
+      bits[index >> 6] |= mask;
+    } else {
+      bits[index >> 6] &= ~mask;
+    }
+  }
+
+  void BuildFit(const MapRect& rect);
+  // Builds the occupy and overlap bits. The fit bits that they depend on must already be built.
+  void BuildOverlap(const MapRect& rect);
+
+  const Map& map_;
+  float radius_;
+  // The ship box spans diameter_ + 1 tiles on each axis.
+  u16 diameter_;
+  // Half size of the square that CanOccupy checks.
+  s32 occupy_radius_;
+
+  // Set if the ship box with its top-left corner at the tile is empty.
+  std::vector<u64> fit_bits_;
+  // Set if any ship box that contains the tile is empty.
+  std::vector<u64> overlap_bits_;
+  // Set if the square of rounded radius around the tile is empty.
+  std::vector<u64> occupy_bits_;
+};
+
+}  // namespace elm
@@ -1,24 +1,35 @@
 #include "RegionRegistry.h"
 
 #include <elm/Map.h>
+#include <elm/OccupancyLayer.h>
 #include <elm/RayCaster.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <unordered_set>
 #include <vector>
 
 namespace elm {
 
-RegionFiller::RegionFiller(const Map& map, float radius, RegionIndex* coord_regions, SharedRegionOwnership* edges)
-    : map(map), radius(radius), coord_regions(coord_regions), edges(edges), highest_coord(9999, 9999) {
-  potential_edges.reserve(1024 * 1024);
+// Whether the tile is part of one of the region's occupiable boxes, so it isn't an edge of the region.
+static bool IsEmptyBaseTile(const Map& map, const OccupancyLayer& layer, const RegionIndex* coord_regions,
+                            MapCoord coord, RegionIndex region) {
+  if (map.IsSolid(coord.x, coord.y)) return false;
 
-  for (size_t i = 0; i < 1024 * 1024; ++i) {
-    potential_edges.push_back(kUndefinedRegion);
-  }
+  OccupyRect rect = layer.GetPossibleOccupyRect(coord.x, coord.y);
+
+  return rect.occupy && (coord_regions[rect.start_y * 1024 + rect.start_x] == region ||
+                         coord_regions[rect.end_y * 1024 + rect.end_x] == region);
 }
 
+RegionFiller::RegionFiller(const Map& map, float radius, RegionIndex* coord_regions, SharedRegionOwnership* edges)
+    : map(map), layer(map.GetOccupancyLayer(radius)), radius(radius), coord_regions(coord_regions), edges(edges) {}
+
 void RegionFiller::FillEmpty(const MapCoord& coord) {
-  if (!map.CanOverlapTile(Vector2f(coord.x, coord.y), radius)) return;
+  potential_edges.clear();
+
+  if (!layer.CanOverlapTile(coord.x, coord.y)) return;
 
   coord_regions[coord.y * 1024 + coord.x] = region_index;
 
@@ -46,117 +57,494 @@ void RegionFiller::TraverseEmpty(const Vector2f& from, MapCoord to) {
 
   size_t to_index = (size_t)to.y * 1024 + to.x;
 
-  if (!map.CanOccupy(Vector2f(to.x, to.y), radius)) {
-    potential_edges[to_index] = region_index;
-
-    if (to.y < highest_coord.y) {
-      highest_coord = to;
-    }
+  if (!layer.CanOccupy(to.x, to.y)) {
+    potential_edges.push_back(to);
   }
 
   if (coord_regions[to_index] == kUndefinedRegion) {
     Vector2f to_pos((float)to.x + 0.5f, (float)to.y + 0.5f);
 
-    if (map.CanTraverse(from, to_pos, radius)) {
+    if (layer.CanTraverse(from, to_pos)) {
       coord_regions[to_index] = region_index;
       stack.push_back(to);
     }
   }
 }
 
-void RegionFiller::FillSolid() {
-  MapCoord coord = highest_coord;
+void RegionFiller::AddEdges() {
+  // The occupiable boxes can only be checked against the region once all of its tiles are labeled.
+  for (MapCoord coord : potential_edges) {
+    size_t index = (size_t)coord.y * 1024 + coord.x;
 
-  if (!IsValidPosition(Vector2f(coord.x, coord.y))) return;
+    if (coord_regions[index] != region_index &&
+        !IsEmptyBaseTile(map, layer, coord_regions, coord, region_index)) {
+      edges[index].AddOwner(region_index);
+    }
+  }
+}
 
-  stack.clear();
+// this method is not working at least for Extreme Games
+void RegionRegistry::CreateAll(const Map& map, float radius) {
+  radius_ = radius;
+  free_regions_.clear();
 
-  stack.push_back(coord);
+  RegionFiller filler(map, radius, coord_regions_, outside_edges_);
+  const OccupancyLayer& layer = filler.layer;
 
-  while (!stack.empty()) {
-    MapCoord current = stack.back();
-    Vector2f current_pos((float)current.x, (float)current.y);
+  for (uint16_t y = 0; y < 1024; ++y) {
+    for (uint16_t x = 0; x < 1024; ++x) {
+      MapCoord coord(x, y);
 
-    stack.pop_back();
+      if (layer.CanOverlapTile(x, y)) {
+        // If the current coord is empty and hasn't been inserted into region
+        // map then create a new region and flood fill it
+        if (!IsRegistered(coord)) {
+          auto region_index = CreateRegion();
+
+          filler.Fill(region_index, coord);
+        }
+      }
+    }
+  }
+}
 
-    if (IsEmptyBaseTile(current_pos)) continue;
+void RegionRegistry::Update(const Map& map, std::span<const MapRect> changed) {
+  const OccupancyLayer& layer = map.GetOccupancyLayer(radius_);
 
-    const MapCoord west(current.x - 1, current.y);
-    const MapCoord northwest(current.x - 1, current.y - 1);
-    const MapCoord southwest(current.x - 1, current.y + 1);
-    const MapCoord east(current.x + 1, current.y);
-    const MapCoord northeast(current.x + 1, current.y - 1);
-    const MapCoord southeast(current.x + 1, current.y + 1);
-    const MapCoord north(current.x, current.y - 1);
-    const MapCoord south(current.x, current.y + 1);
+  // Traversal checks reach up to the ship's diameter to the side of the tiles being tested.
+  s32 margin = layer.GetInfluence() + (s32)std::ceil(radius_ * 2.0f) + 1;
 
-    TraverseSolid(current_pos, west);
-    TraverseSolid(current_pos, northwest);
-    TraverseSolid(current_pos, southwest);
-    TraverseSolid(current_pos, east);
-    TraverseSolid(current_pos, northeast);
-    TraverseSolid(current_pos, southeast);
-    TraverseSolid(current_pos, north);
-    TraverseSolid(current_pos, south);
+  // Each rect is relabeled from the ring of unchanged tiles around it, so rects that reach into each other's rings,
+  // like the pieces of a door, are combined first.
+  std::vector<MapRect> inners;
+
+  for (const MapRect& rect : changed) {
+    inners.push_back(rect.Expand(margin));
   }
-}
 
-bool RegionFiller::IsEmptyBaseTile(const Vector2f& position) const {
-  if (map.IsSolid(position)) return false;
+  auto overlaps = [](const MapRect& a, const MapRect& b) {
+    return a.start_x <= b.end_x && b.start_x <= a.end_x && a.start_y <= b.end_y && b.start_y <= a.end_y;
+  };
+
+  for (bool combined = true; combined;) {
+    combined = false;
 
-  OccupyRect rect = map.GetPossibleOccupyRect(position, radius);
+    for (size_t i = 0; i < inners.size(); ++i) {
+      for (size_t j = i + 1; j < inners.size(); ++j) {
+        if (!overlaps(inners[i].Expand(1), inners[j])) continue;
 
-  if (rect.occupy) {
-    size_t top_index = rect.start_y * 1024 + rect.start_x;
-    size_t bottom_index = rect.end_y * 1024 + rect.end_x;
+        inners[i].start_x = std::min(inners[i].start_x, inners[j].start_x);
+        inners[i].start_y = std::min(inners[i].start_y, inners[j].start_y);
+        inners[i].end_x = std::max(inners[i].end_x, inners[j].end_x);
+        inners[i].end_y = std::max(inners[i].end_y, inners[j].end_y);
 
-    if (coord_regions[top_index] == region_index || coord_regions[bottom_index] == region_index) {
-      return true;
+        inners[j--] = inners.back();
+        inners.pop_back();
+        combined = true;
+      }
     }
   }
 
-  return false;
+  for (const MapRect& inner : inners) {
+    UpdateLocal(map, layer, inner);
+  }
 }
 
-void RegionFiller::TraverseSolid(const Vector2f& from, MapCoord to) {
-  if (!IsValidPosition(Vector2f(to.x, to.y))) return;
+void RegionRegistry::UpdateLocal(const Map& map, const OccupancyLayer& layer, const MapRect& inner) {
+  // Traversal only changed inside of the inner rect. The ring of tiles around it is unchanged and keeps the labels
+  // that connect the area to the rest of its regions.
+  MapRect area = inner.Expand(1);
 
-  size_t to_index = (size_t)to.y * 1024 + to.x;
+  s32 width = area.end_x - area.start_x + 1;
+  s32 height = area.end_y - area.start_y + 1;
+
+  auto get_local_index = [&area, width](MapCoord coord) {
+    return (size_t)(coord.y - area.start_y) * width + (coord.x - area.start_x);
+  };
+
+  // Find the connected components of the area with the same traversal that the filler uses.
+  constexpr s32 kNoComponent = -1;
+
+  std::vector<s32> components((size_t)width * height, kNoComponent);
+  // The regions of the ring tiles that each component reaches, with one ring tile of each region.
+  std::vector<std::vector<std::pair<RegionIndex, MapCoord>>> component_regions;
+  // Every ring tile with the component that contains it.
+  std::vector<std::pair<MapCoord, s32>> ring_tiles;
+  std::vector<MapCoord> stack;
+
+  for (s32 y = area.start_y; y <= area.end_y; ++y) {
+    for (s32 x = area.start_x; x <= area.end_x; ++x) {
+      MapCoord start((u16)x, (u16)y);
+
+      if (components[get_local_index(start)] != kNoComponent || !layer.CanOverlapTile(start.x, start.y)) continue;
+
+      s32 component = (s32)component_regions.size();
 
-  if (potential_edges[to_index] == region_index) {
-    stack.push_back(to);
-    potential_edges[to_index] = kUndefinedRegion;
+      component_regions.emplace_back();
+      components[get_local_index(start)] = component;
+      stack.push_back(start);
 
-    // Add an edge if this tile is not traversable and it's not already one of the empty region tiles.
-    // if (coord_regions[to_index] != region_index && !map.CanOccupy(Vector2f(to.x, to.y), 0.8f)) {
-    if (coord_regions[to_index] != region_index) {
-      Vector2f to_pos = Vector2f((float)to.x, (float)to.y);
+      while (!stack.empty()) {
+        MapCoord current = stack.back();
+        stack.pop_back();
 
-      if (!IsEmptyBaseTile(to_pos)) {
-        edges[to_index].AddOwner(region_index);
+        RegionIndex ring_region = inner.Contains(current.x, current.y) ? kUndefinedRegion
+                                                                          : coord_regions_[current.y * 1024 + current.x];
+
+        if (ring_region != kUndefinedRegion) {
+          auto& regions = component_regions[component];
+          RegionIndex region = ring_region;
+
+          ring_tiles.emplace_back(current, component);
+
+          auto has_region = [region](const auto& entry) { return entry.first == region; };
+
+          if (std::find_if(regions.begin(), regions.end(), has_region) == regions.end()) {
+            regions.emplace_back(region, current);
+          }
+        }
+
+        const Vector2f current_pos((float)current.x + 0.5f, (float)current.y + 0.5f);
+        const MapCoord neighbors[] = {MapCoord(current.x - 1, current.y), MapCoord(current.x + 1, current.y),
+                                      MapCoord(current.x, current.y - 1), MapCoord(current.x, current.y + 1)};
+
+        for (const MapCoord& neighbor : neighbors) {
+          if (!area.Contains(neighbor.x, neighbor.y)) continue;
+
+          s32& neighbor_component = components[get_local_index(neighbor)];
+
+          if (neighbor_component != kNoComponent) continue;
+
+          Vector2f neighbor_pos((float)neighbor.x + 0.5f, (float)neighbor.y + 0.5f);
+
+          if (layer.CanTraverse(current_pos, neighbor_pos)) {
+            neighbor_component = component;
+            stack.push_back(neighbor);
+          }
+        }
       }
     }
   }
-}
 
-// this method is not working at least for Extreme Games
-void RegionRegistry::CreateAll(const Map& map, float radius) {
-  RegionFiller filler(map, radius, coord_regions_, outside_edges_);
+  // Components that reach the same region are connected through it unless the change split the region.
+  std::vector<s32> component_sets(component_regions.size());
 
-  for (uint16_t y = 0; y < 1024; ++y) {
-    for (uint16_t x = 0; x < 1024; ++x) {
-      MapCoord coord(x, y);
+  for (s32 component = 0; component < (s32)component_sets.size(); ++component) {
+    component_sets[component] = component;
+  }
 
-      if (map.CanOverlapTile(Vector2f(x, y), radius)) {
-        // If the current coord is empty and hasn't been inserted into region
-        // map then create a new region and flood fill it
-        if (!IsRegistered(coord)) {
-          auto region_index = CreateRegion();
+  auto find_set = [&component_sets](s32 component) {
+    while (component_sets[component] != component) {
+      component_sets[component] = component_sets[component_sets[component]];
+      component = component_sets[component];
+    }
 
-          filler.Fill(region_index, coord);
+    return component;
+  };
+
+  std::unordered_map<RegionIndex, std::vector<s32>> region_components;
+
+  for (s32 component = 0; component < (s32)component_regions.size(); ++component) {
+    for (const auto& entry : component_regions[component]) {
+      region_components[entry.first].push_back(component);
+    }
+  }
+
+  // The part of a region outside of the inner rect that is reached from some of the ring tiles.
+  struct Front {
+    RegionIndex region;
+    s32 component;
+    // Every tile found so far in the order they were found. The tiles from head on still need to be walked.
+    std::vector<u32> tiles;
+    size_t head = 0;
+
+    bool IsGrowing() const { return head < tiles.size(); }
+  };
+
+  std::vector<Front> fronts;
+  std::unordered_map<u32, size_t> front_tiles;
+  std::vector<s32> growing_groups;
+
+  // Walks the fronts a few tiles at a time each until at most one group of them is still growing. Fronts that meet
+  // are joined into one group, so a group that stopped growing has found all of its part of the region. The part
+  // that is still growing is the largest one, and it's never walked to the end.
+  auto walk_fronts = [&](auto&& get_group, auto&& join) {
+    constexpr size_t kStepTiles = 64;
+
+    front_tiles.clear();
+
+    for (size_t i = 0; i < fronts.size(); ++i) {
+      for (u32 index : fronts[i].tiles) {
+        front_tiles.emplace(index, i);
+      }
+    }
+
+    while (true) {
+      growing_groups.clear();
+
+      for (size_t i = 0; i < fronts.size(); ++i) {
+        s32 group = get_group(i);
+
+        if (fronts[i].IsGrowing() &&
+            std::find(growing_groups.begin(), growing_groups.end(), group) == growing_groups.end()) {
+          growing_groups.push_back(group);
+        }
+      }
+
+      if (growing_groups.size() <= 1) return;
+
+      for (size_t i = 0; i < fronts.size(); ++i) {
+        Front& front = fronts[i];
+
+        for (size_t step = 0; step < kStepTiles && front.IsGrowing(); ++step) {
+          u32 current_index = front.tiles[front.head++];
+          MapCoord current(current_index % 1024, current_index / 1024);
+
+          const Vector2f current_pos((float)current.x + 0.5f, (float)current.y + 0.5f);
+          const MapCoord neighbors[] = {MapCoord(current.x - 1, current.y), MapCoord(current.x + 1, current.y),
+                                        MapCoord(current.x, current.y - 1), MapCoord(current.x, current.y + 1)};
+
+          for (const MapCoord& neighbor : neighbors) {
+            if (!IsValidPosition(neighbor) || inner.Contains(neighbor.x, neighbor.y)) continue;
+
+            u32 neighbor_index = neighbor.y * 1024 + neighbor.x;
+
+            if (coord_regions_[neighbor_index] != front.region) continue;
+
+            Vector2f neighbor_pos((float)neighbor.x + 0.5f, (float)neighbor.y + 0.5f);
+
+            if (!layer.CanTraverse(current_pos, neighbor_pos)) continue;
+
+            auto result = front_tiles.emplace(neighbor_index, i);
+
+            if (result.second) {
+              front.tiles.push_back(neighbor_index);
+            } else if (get_group(result.first->second) != get_group(i)) {
+              join(result.first->second, i);
+            }
+          }
         }
       }
     }
+  };
+
+  auto is_growing_group = [&growing_groups](s32 group) {
+    return std::find(growing_groups.begin(), growing_groups.end(), group) != growing_groups.end();
+  };
+
+  auto add_ring_seeds = [&](Front& front, auto&& is_seed) {
+    for (const auto& [coord, component] : ring_tiles) {
+      if (coord_regions_[coord.y * 1024 + coord.x] == front.region && is_seed(component)) {
+        front.tiles.push_back(coord.y * 1024 + coord.x);
+      }
+    }
+  };
+
+  // The parts of regions that are walked to the end and might need another label, with a component of the set that
+  // they're connected to.
+  struct Piece {
+    RegionIndex region;
+    s32 component;
+    std::vector<u32> tiles;
+  };
+
+  std::vector<Piece> pieces;
+  // The component whose set keeps the part of each region that isn't one of the pieces.
+  std::unordered_map<RegionIndex, s32> region_owners;
+
+  // Find the sets of components that are still connected through each region outside of the inner rect.
+  for (const auto& [region, connected] : region_components) {
+    if (connected.size() == 1) {
+      region_owners[region] = connected[0];
+      continue;
+    }
+
+    fronts.clear();
+
+    for (s32 component : connected) {
+      Front& front = fronts.emplace_back();
+
+      front.region = region;
+      front.component = component;
+      add_ring_seeds(front, [component](s32 seed_component) { return seed_component == component; });
+    }
+
+    walk_fronts([&](size_t i) { return find_set(fronts[i].component); },
+                [&](size_t a, size_t b) { component_sets[find_set(fronts[a].component)] = find_set(fronts[b].component); });
+
+    region_owners[region] = kNoComponent;
+
+    for (Front& front : fronts) {
+      if (is_growing_group(find_set(front.component))) {
+        region_owners[region] = front.component;
+      } else {
+        pieces.push_back({region, front.component, std::move(front.tiles)});
+      }
+    }
+  }
+
+  // A set that keeps parts of several regions merged them, so all but the largest part are relabeled.
+  std::unordered_map<s32, std::vector<RegionIndex>> set_regions;
+
+  for (const auto& [region, component] : region_owners) {
+    if (component != kNoComponent) {
+      set_regions[find_set(component)].push_back(region);
+    }
+  }
+
+  for (const auto& [set, regions] : set_regions) {
+    if (regions.size() < 2) continue;
+
+    fronts.clear();
+
+    for (RegionIndex region : regions) {
+      Front& front = fronts.emplace_back();
+
+      front.region = region;
+      front.component = region_owners[region];
+      add_ring_seeds(front, [&, set](s32 seed_component) { return find_set(seed_component) == set; });
+    }
+
+    // The parts never meet since they have different labels.
+    walk_fronts([](size_t i) { return (s32)i; }, [](size_t, size_t) {});
+
+    size_t kept = 0;
+
+    while (kept < fronts.size() && !fronts[kept].IsGrowing()) ++kept;
+    if (kept == fronts.size()) kept = 0;
+
+    for (size_t i = 0; i < fronts.size(); ++i) {
+      if (i == kept) continue;
+
+      region_owners[fronts[i].region] = kNoComponent;
+      pieces.push_back({fronts[i].region, fronts[i].component, std::move(fronts[i].tiles)});
+    }
+  }
+
+  // Each set keeps the label of the region part that it owns, otherwise it takes the first unused region that it
+  // reaches. Sets that don't have one get a new region.
+  std::vector<RegionIndex> set_labels(component_regions.size(), kUndefinedRegion);
+  std::unordered_set<RegionIndex> kept_regions;
+
+  for (const auto& [region, component] : region_owners) {
+    if (component != kNoComponent) {
+      set_labels[find_set(component)] = region;
+      kept_regions.insert(region);
+    }
+  }
+
+  for (s32 component = 0; component < (s32)component_regions.size(); ++component) {
+    RegionIndex& label = set_labels[find_set(component)];
+
+    for (size_t i = 0; i < component_regions[component].size() && label == kUndefinedRegion; ++i) {
+      RegionIndex region = component_regions[component][i].first;
+
+      if (kept_regions.insert(region).second) {
+        label = region;
+      }
+    }
+  }
+
+  // A region that doesn't reach the ring was only inside of the inner rect, so all of its tiles are relabeled.
+  std::unordered_set<RegionIndex> released_regions;
+
+  for (s32 y = inner.start_y; y <= inner.end_y; ++y) {
+    for (s32 x = inner.start_x; x <= inner.end_x; ++x) {
+      RegionIndex region = coord_regions_[y * 1024 + x];
+
+      if (region != kUndefinedRegion && region_components.find(region) == region_components.end()) {
+        released_regions.insert(region);
+      }
+    }
+  }
+
+  for (const auto& entry : region_components) {
+    if (kept_regions.find(entry.first) == kept_regions.end()) {
+      released_regions.insert(entry.first);
+    }
+  }
+
+  std::vector<RegionIndex> component_labels(component_regions.size());
+
+  for (s32 component = 0; component < (s32)component_regions.size(); ++component) {
+    RegionIndex& label = set_labels[find_set(component)];
+
+    if (label == kUndefinedRegion) {
+      label = CreateRegion();
+    }
+
+    component_labels[component] = label;
+  }
+
+  for (RegionIndex region : released_regions) {
+    ReleaseRegion(region);
+  }
+
+  std::vector<u32> relabeled;
+
+  for (const Piece& piece : pieces) {
+    RegionIndex label = set_labels[find_set(piece.component)];
+
+    if (label == piece.region) continue;
+
+    for (u32 index : piece.tiles) {
+      coord_regions_[index] = label;
+    }
+
+    relabeled.insert(relabeled.end(), piece.tiles.begin(), piece.tiles.end());
+  }
+
+  for (s32 y = inner.start_y; y <= inner.end_y; ++y) {
+    for (s32 x = inner.start_x; x <= inner.end_x; ++x) {
+      s32 component = components[get_local_index(MapCoord((u16)x, (u16)y))];
+
+      coord_regions_[y * 1024 + x] = component == kNoComponent ? kUndefinedRegion : component_labels[component];
+    }
+  }
+
+  // An edge depends on the labels next to it and on the labels of its occupiable box, which is within the ship's
+  // diameter of it.
+  s32 reach = std::max<s32>(1, layer.GetDiameter());
+  MapRect edge_area = area.Expand(reach);
+
+  for (s32 y = edge_area.start_y; y <= edge_area.end_y; ++y) {
+    for (s32 x = edge_area.start_x; x <= edge_area.end_x; ++x) {
+      BuildEdge(map, layer, MapCoord((u16)x, (u16)y));
+    }
+  }
+
+  for (u32 index : relabeled) {
+    MapRect rect = MapRect(index % 1024, index / 1024, index % 1024, index / 1024).Expand(reach);
+
+    for (s32 y = rect.start_y; y <= rect.end_y; ++y) {
+      for (s32 x = rect.start_x; x <= rect.end_x; ++x) {
+        BuildEdge(map, layer, MapCoord((u16)x, (u16)y));
+      }
+    }
+  }
+}
+
+void RegionRegistry::BuildEdge(const Map& map, const OccupancyLayer& layer, MapCoord coord) {
+  size_t index = (size_t)coord.y * 1024 + coord.x;
+  SharedRegionOwnership& ownership = outside_edges_[index];
+
+  ownership.count = 0;
+
+  if (layer.CanOccupy(coord.x, coord.y)) return;
+
+  const MapCoord neighbors[] = {MapCoord(coord.x - 1, coord.y), MapCoord(coord.x + 1, coord.y),
+                                MapCoord(coord.x, coord.y - 1), MapCoord(coord.x, coord.y + 1)};
+
+  for (const MapCoord& neighbor : neighbors) {
+    if (!IsValidPosition(neighbor)) continue;
+
+    RegionIndex region = coord_regions_[neighbor.y * 1024 + neighbor.x];
+
+    if (region == kUndefinedRegion || region == coord_regions_[index]) continue;
+
+    if (!IsEmptyBaseTile(map, layer, coord_regions_, coord, region)) {
+      ownership.AddOwner(region);
+    }
   }
 }
 
@@ -197,7 +585,18 @@ void RegionRegistry::Insert(MapCoord coord, RegionIndex index) {
   coord_regions_[coord.y * 1024 + coord.x] = index;
 }
 
-RegionIndex RegionRegistry::CreateRegion() { return region_count_++; }
+RegionIndex RegionRegistry::CreateRegion() {
+  if (!free_regions_.empty()) {
+    RegionIndex index = free_regions_.back();
+
+    free_regions_.pop_back();
+    return index;
+  }
+
+  return region_count_++;
+}
+
+void RegionRegistry::ReleaseRegion(RegionIndex index) { free_regions_.push_back(index); }
 
 RegionIndex RegionRegistry::GetRegionIndex(MapCoord coord) {
   // auto itr = coord_regions_.find(coord);
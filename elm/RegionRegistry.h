@@ -7,12 +7,15 @@
 #include <cstdlib>
 #include <functional>
 #include <memory>
+#include <span>
 #include <unordered_map>
 #include <vector>
 
 namespace elm {
 
 class Map;
+class OccupancyLayer;
+struct MapRect;
 
 using RegionIndex = std::size_t;
 
@@ -52,6 +55,19 @@ struct SharedRegionOwnership {
     return true;
   }
 
+  void RemoveOwner(RegionIndex index) {
+    for (size_t i = 0; i < count; ++i) {
+      if (owners[i] == index) {
+        for (size_t j = i + 1; j < count; ++j) {
+          owners[j - 1] = owners[j];
+        }
+
+        --count;
+        return;
+      }
+    }
+  }
+
   bool HasOwner(RegionIndex index) const {
     for (size_t i = 0; i < count; ++i) {
       if (owners[i] == index) return true;
@@ -60,17 +76,20 @@ struct SharedRegionOwnership {
   }
 };
 
+// A tile is an edge of a region when ships can't occupy it, it's next to one of the region's tiles and it isn't part of
+// one of the region's occupiable boxes. CreateAll and the updates both use this rule, so the edges only depend on the
+// current tiles and regions.
 struct RegionFiller {
   const Map& map;
+  const OccupancyLayer& layer;
   RegionIndex region_index;
   float radius;
 
   RegionIndex* coord_regions;
   SharedRegionOwnership* edges;
 
-  MapCoord highest_coord;
-
-  std::vector<RegionIndex> potential_edges;
+  // The tiles next to the region being filled that ships can't occupy. They are checked once the region is filled.
+  std::vector<MapCoord> potential_edges;
 
   std::vector<MapCoord> stack;
 
@@ -80,19 +99,14 @@ struct RegionFiller {
     this->region_index = index;
 
     FillEmpty(coord);
-    FillSolid();
-
-    highest_coord = MapCoord(9999, 9999);
+    AddEdges();
   }
 
  private:
   void FillEmpty(const MapCoord& coord);
   void TraverseEmpty(const Vector2f& from, MapCoord to);
 
-  void FillSolid();
-  void TraverseSolid(const Vector2f& from, MapCoord to);
-
-  bool IsEmptyBaseTile(const Vector2f& position) const;
+  void AddEdges();
 };
 
 class RegionRegistry {
@@ -103,6 +117,10 @@ class RegionRegistry {
   bool IsEdge(MapCoord coord) const;
 
   void CreateAll(const Map& map, float radius);
+  // Relabels the regions around the rects of tiles that changed solidity, using the radius from CreateAll. Each rect
+  // is relabeled around the change, so regions that are merged or split only have the smaller side relabeled and
+  // regions that don't reach the change are left alone.
+  void Update(const Map& map, std::span<const MapRect> changed);
 
   void DebugUpdate(Vector2f position);
 
@@ -110,11 +128,25 @@ class RegionRegistry {
   void Insert(MapCoord coord, RegionIndex index);
   std::size_t GetRegionIndex(MapCoord coord);
 
+  // Reuses the index of a region that no longer has any tiles before creating a new one.
   RegionIndex CreateRegion();
 
+  // One past the highest region index that has been used.
   RegionIndex region_count_;
+  float radius_ = 0.0f;
+  // Indices below region_count_ whose regions were removed by updates.
+  std::vector<RegionIndex> free_regions_;
 
   RegionIndex coord_regions_[1024 * 1024];
   SharedRegionOwnership outside_edges_[1024 * 1024];
+
+ private:
+  // Relabels the tiles in the inner rect from the labels of the ring of tiles around it, then relabels the parts of
+  // the regions outside of it that were merged or split by the change.
+  void UpdateLocal(const Map& map, const OccupancyLayer& layer, const MapRect& inner);
+  // Rebuilds which regions the tile is an edge of.
+  void BuildEdge(const Map& map, const OccupancyLayer& layer, MapCoord coord);
+  // Marks an index as unused once none of the tiles or edges have it.
+  void ReleaseRegion(RegionIndex index);
 };
 }  // namespace elm
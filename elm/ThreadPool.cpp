@@ -0,0 +1,81 @@
+#include "ThreadPool.h"
+
+namespace elm {
+
+ThreadPool::ThreadPool(size_t thread_count) {
+  if (thread_count == 0) {
+    thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0) thread_count = 1;
+  }
+
+  threads_.reserve(thread_count);
+
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+
+  work_cv_.notify_all();
+
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::Run(size_t job_count, const Job& job) {
+  if (job_count == 0) return;
+
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  job_ = &job;
+  job_count_ = job_count;
+  next_job_ = 0;
+  active_workers_ = threads_.size();
+  ++batch_;
+
+  work_cv_.notify_all();
+  done_cv_.wait(lock, [this] { return active_workers_ == 0; });
+
+  job_ = nullptr;
+}
+
+void ThreadPool::WorkerLoop(size_t worker_index) {
+  u64 last_batch = 0;
+
+  while (true) {
+    const Job* job = nullptr;
+    size_t job_count = 0;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this, last_batch] { return stopping_ || batch_ != last_batch; });
+
+      if (stopping_) return;
+
+      last_batch = batch_;
+      job = job_;
+      job_count = job_count_;
+    }
+
+    // Pull jobs one at a time so uneven job costs still balance between the workers.
+    for (size_t index = next_job_.fetch_add(1); index < job_count; index = next_job_.fetch_add(1)) {
+      (*job)(worker_index, index);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--active_workers_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+}
+
+}  // namespace elm
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <elm/Types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace elm {
+
+// Persistent set of worker threads that split a batch of jobs between them.
+class ThreadPool {
+ public:
+  // Job function is called with the worker index and the job index.
+  using Job = std::function<void(size_t worker_index, size_t job_index)>;
+
+  // A thread count of zero uses the hardware thread count.
+  explicit ThreadPool(size_t thread_count = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  inline size_t GetThreadCount() const { return threads_.size(); }
+
+  // Runs the job for every index in [0, job_count) and blocks until all of them are finished.
+  // Each worker index is only used by one thread at a time, so it can select per-worker scratch memory.
+  void Run(size_t job_count, const Job& job);
+
+ private:
+  void WorkerLoop(size_t worker_index);
+
+  std::vector<std::thread> threads_;
+
+  // Only one batch can be running at a time.
+  std::mutex run_mutex_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+
+  const Job* job_ = nullptr;
+  size_t job_count_ = 0;
+  std::atomic<size_t> next_job_ = 0;
+  size_t active_workers_ = 0;
+  u64 batch_ = 0;
+  bool stopping_ = false;
+};
+
+}  // namespace elm
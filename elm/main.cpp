@@ -1,5 +1,6 @@
 #include <elm/Elm.h>
 #include <elm/Map.h>
+#include <elm/NavCache.h>
 #include <elm/Timer.h>
 #include <elm/path/Pathfinder.h>
 //
@@ -12,6 +13,9 @@ using namespace elm;
 using ms_float = std::chrono::duration<float, std::milli>;
 
 const char* kMapFilename = "jun2018.lvl";
+// Precomputed navigation data for the map is loaded from and saved to this file, and rebuilt when the map or ship
+// settings change. It's off by default so nothing is written to the working directory, and null keeps it off.
+const char* kNavCacheFilename = nullptr;
 
 struct PathRequest {
   Vector2f start;
@@ -27,6 +31,9 @@ PathRequest path_request(Vector2f(828, 341), Vector2f(820, 210), Vector2f(830, 2
 
 const bool kEnableLinearWeights = true;
 
+// Zero uses every hardware thread when building the map weights.
+const size_t kWeightThreadCount = 0;
+
 const float kShipRadius = 14.0f / 16.0f;
 // float kShipRadius = 39.0f / 16.0f;
 
@@ -88,38 +95,58 @@ int main(int argc, char* argv[]) {
   printf("Elm::Init::Time: %lluus\n", perf_timer.GetElapsedTime());
 
   std::unique_ptr<RegionRegistry> registry = std::make_unique<RegionRegistry>(*map);
-  registry->CreateAll(*map, kShipRadius);
-
-  printf("Registry::Time: %lluus\n", perf_timer.GetElapsedTime());
 
   float frame_time = 0.0f;
 
   auto processor = std::make_unique<elm::path::NodeProcessor>(*map);
   elm::path::Pathfinder pathfinder(std::move(processor));
 
-  pathfinder.CreateMapWeights(*map, kShipRadius, kEnableLinearWeights);
+  NavCacheKey nav_cache_key(*map, kShipRadius, kEnableLinearWeights);
+
+  if (kNavCacheFilename && nav_cache::Load(kNavCacheFilename, nav_cache_key, pathfinder, *registry)) {
+    printf("NavCache::Load::Time: %lluus\n", perf_timer.GetElapsedTime());
+  } else {
+    registry->CreateAll(*map, kShipRadius);
+
+    printf("Registry::Time: %lluus\n", perf_timer.GetElapsedTime());
+
+    pathfinder.CreateMapWeights(*map, kShipRadius, kEnableLinearWeights, kWeightThreadCount);
+
+    printf("Pathfinder::Init::Time: %lluus\n", perf_timer.GetElapsedTime());
+
+    if (kNavCacheFilename && !nav_cache::Save(kNavCacheFilename, nav_cache_key, pathfinder, *registry)) {
+      fprintf(stderr, "Failed to save nav cache '%s'\n", kNavCacheFilename);
+    }
+  }
+
+  // Doors and runtime tile changes only update the navigation data around the tiles that changed.
+  map->AddChangeListener(
+      [&pathfinder, &registry](const Map& changed_map, std::span<const MapRect> changed, TileChangeType type) {
+        pathfinder.UpdateMapWeights(changed_map, changed);
+
+        // Regions only depend on solidity.
+        if (type == TileChangeType::Solidity) {
+          registry->Update(changed_map, changed);
+        }
+      });
 
-  printf("Pathfinder::Init::Time: %lluus\n", perf_timer.GetElapsedTime());
+  // Requests into other regions can be answered from the registry instead of searching every reachable node.
+  pathfinder.SetRegionRegistry(registry.get());
 
 #if PERFORMANCE_PROFILE  // A lot of pathing for Performance Profile.
   constexpr size_t kPathCount = 1000;
 
-  std::vector<u64> timers(kPathCount);
+  std::vector<elm::path::PathQuery> queries(
+      kPathCount, elm::path::PathQuery(path_request.start, path_request.end, kShipRadius));
+  std::vector<std::vector<Vector2f>> paths(kPathCount);
 
   Timer path_timer;
-  for (size_t i = 0; i < kPathCount; ++i) {
-    auto path = pathfinder.FindPath(path_request.start, path_request.end, kShipRadius);
+  pathfinder.FindPaths(queries, paths);
+  u64 batch_time = path_timer.GetElapsedTime();
 
-    printf("Path size: %zd\n", path.size());
-    timers[i] = path_timer.GetElapsedTime();
-  }
-
-  u64 sum = 0;
-  for (size_t i = 0; i < kPathCount; ++i) {
-    sum += timers[i];
-  }
-  u64 avg = sum / kPathCount;
-  printf("Path avg time: %llu\n", avg);
+  printf("Path size: %zd\n", paths[0].size());
+  printf("Path batch time: %llu\n", batch_time);
+  printf("Path avg time: %llu\n", batch_time / kPathCount);
 #endif
 
   elm.path = pathfinder.FindPath(path_request.start, path_request.end, kShipRadius);
@@ -0,0 +1,395 @@
+#include "ClusterGraph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+
+namespace elm {
+namespace path {
+
+// Runs of crossable nodes at least this long get an entrance at each end instead of one in the middle.
+constexpr s32 kLongEntranceLength = 6;
+
+static inline float GetDistance(NodePoint from, NodePoint to) {
+  float dx = (float)(from.x - to.x);
+  float dy = (float)(from.y - to.y);
+
+  return std::sqrt(dx * dx + dy * dy);
+}
+
+ClusterGraph::ClusterGraph(const NodeProcessor& processor)
+    : processor_(processor), clusters_(kClusterCount), east_borders_(kClusterCount), south_borders_(kClusterCount) {}
+
+void ClusterGraph::Build() {
+  for (u32 i = 0; i < kClusterCount; ++i) {
+    BuildBorder(i, true);
+    BuildBorder(i, false);
+  }
+
+  for (u32 i = 0; i < kClusterCount; ++i) {
+    BuildCluster(i);
+  }
+
+  UpdateEntranceIds();
+}
+
+void ClusterGraph::Update(const MapRect& rect) {
+  s32 start_x = rect.start_x / kClusterSize;
+  s32 start_y = rect.start_y / kClusterSize;
+  s32 end_x = rect.end_x / kClusterSize;
+  s32 end_y = rect.end_y / kClusterSize;
+
+  // The borders on every side of the changed clusters can gain or lose transitions.
+  for (s32 y = std::max(start_y - 1, 0); y <= end_y; ++y) {
+    for (s32 x = std::max(start_x - 1, 0); x <= end_x; ++x) {
+      u32 cluster_index = (u32)(y * kClustersPerRow + x);
+
+      if (y >= start_y) BuildBorder(cluster_index, true);
+      if (x >= start_x) BuildBorder(cluster_index, false);
+    }
+  }
+
+  // The clusters around them have entrances on those borders.
+  for (s32 y = std::max(start_y - 1, 0); y <= std::min(end_y + 1, kClustersPerRow - 1); ++y) {
+    for (s32 x = std::max(start_x - 1, 0); x <= std::min(end_x + 1, kClustersPerRow - 1); ++x) {
+      BuildCluster((u32)(y * kClustersPerRow + x));
+    }
+  }
+
+  UpdateEntranceIds();
+}
+
+void ClusterGraph::UpdateEntranceIds() {
+  entrance_offsets_.resize(kClusterCount + 1);
+  entrance_offsets_[0] = 0;
+
+  for (size_t i = 0; i < kClusterCount; ++i) {
+    entrance_offsets_[i + 1] = entrance_offsets_[i] + (u32)clusters_[i].entrances.size();
+  }
+
+  for (Cluster& cluster : clusters_) {
+    for (Entrance& entrance : cluster.entrances) {
+      for (size_t i = 0; i < entrance.link_count; ++i) {
+        Link& link = entrance.links[i];
+        u32 link_cluster = GetClusterIndex(NavGraph::GetPoint(link.index));
+
+        link.entrance_id = entrance_offsets_[link_cluster] + clusters_[link_cluster].FindEntrance(link.index);
+      }
+    }
+  }
+}
+
+void ClusterGraph::BuildBorder(u32 cluster_index, bool vertical) {
+  std::vector<Transition>& transitions = vertical ? east_borders_[cluster_index] : south_borders_[cluster_index];
+  const NavGraph& graph = processor_.GetGraph();
+  MapRect rect = GetClusterRect(cluster_index);
+
+  transitions.clear();
+
+  // The clusters on the edge of the map don't have a border on that side.
+  if (vertical && rect.end_x >= 1023) return;
+  if (!vertical && rect.end_y >= 1023) return;
+
+  size_t forward = vertical ? CoordOffset::EastIndex() : CoordOffset::SouthIndex();
+  size_t backward = vertical ? CoordOffset::WestIndex() : CoordOffset::NorthIndex();
+
+  // Returns the pair of nodes across the border at the step along it.
+  auto get_pair = [&rect, vertical](s32 step) {
+    NodePoint first = vertical ? NodePoint(rect.end_x, rect.start_y + step) : NodePoint(rect.start_x + step, rect.end_y);
+    NodePoint second = vertical ? NodePoint(first.x + 1, first.y) : NodePoint(first.x, first.y + 1);
+
+    return Transition{NavGraph::GetIndex(first), NavGraph::GetIndex(second)};
+  };
+
+  auto is_crossable = [&](s32 step) {
+    Transition pair = get_pair(step);
+    return graph.edges[pair.first].IsSet(forward) && graph.edges[pair.second].IsSet(backward);
+  };
+
+  s32 step = 0;
+
+  while (step < kClusterSize) {
+    if (!is_crossable(step)) {
+      ++step;
+      continue;
+    }
+
+    s32 run_start = step;
+
+    while (step < kClusterSize && is_crossable(step)) {
+      ++step;
+    }
+
+    s32 run_end = step - 1;
+
+    if (run_end - run_start + 1 >= kLongEntranceLength) {
+      transitions.push_back(get_pair(run_start));
+      transitions.push_back(get_pair(run_end));
+    } else {
+      transitions.push_back(get_pair((run_start + run_end) / 2));
+    }
+  }
+}
+
+void ClusterGraph::BuildCluster(u32 cluster_index) {
+  Cluster& cluster = clusters_[cluster_index];
+  s32 cluster_x = (s32)(cluster_index % kClustersPerRow);
+  s32 cluster_y = (s32)(cluster_index / kClustersPerRow);
+
+  cluster.entrances.clear();
+
+  auto add_entrance = [this, &cluster](u32 index, u32 across_index) {
+    Link link = {across_index, processor_.GetWeight(across_index), 0};
+    int existing = cluster.FindEntrance(index);
+
+    if (existing >= 0) {
+      Entrance& entrance = cluster.entrances[existing];
+      entrance.links[entrance.link_count++] = link;
+      return;
+    }
+
+    Entrance entrance = {};
+
+    entrance.index = index;
+    entrance.links[0] = link;
+    entrance.link_count = 1;
+
+    cluster.entrances.push_back(entrance);
+  };
+
+  for (const Transition& transition : east_borders_[cluster_index]) {
+    add_entrance(transition.first, transition.second);
+  }
+
+  for (const Transition& transition : south_borders_[cluster_index]) {
+    add_entrance(transition.first, transition.second);
+  }
+
+  if (cluster_x > 0) {
+    for (const Transition& transition : east_borders_[cluster_index - 1]) {
+      add_entrance(transition.second, transition.first);
+    }
+  }
+
+  if (cluster_y > 0) {
+    for (const Transition& transition : south_borders_[cluster_index - kClustersPerRow]) {
+      add_entrance(transition.second, transition.first);
+    }
+  }
+
+  size_t count = cluster.entrances.size();
+
+  cluster.costs.resize(count * count);
+  cluster.path_offsets.resize(count * count + 1);
+  cluster.path_nodes.clear();
+
+  std::unique_ptr<ClusterSearch> search = std::make_unique<ClusterSearch>();
+
+  for (size_t i = 0; i < count; ++i) {
+    SearchCluster(cluster.entrances[i].index, *search);
+
+    for (size_t j = 0; j < count; ++j) {
+      size_t local_index = search->GetLocalIndex(cluster.entrances[j].index);
+      size_t path_begin = cluster.path_nodes.size();
+
+      cluster.costs[i * count + j] = search->costs[local_index];
+      cluster.path_offsets[i * count + j] = (u32)path_begin;
+
+      if (i == j || search->costs[local_index] == kInfiniteCost) continue;
+
+      // The parents lead back to the entrance that was searched from, so the path is built backwards.
+      for (size_t current = local_index; search->parents[current] != kNoParent; current = search->parents[current]) {
+        cluster.path_nodes.push_back(search->GetIndex(current));
+      }
+
+      std::reverse(cluster.path_nodes.begin() + path_begin, cluster.path_nodes.end());
+    }
+  }
+
+  cluster.path_offsets[count * count] = (u32)cluster.path_nodes.size();
+}
+
+void ClusterGraph::SearchCluster(u32 index, ClusterSearch& search) const {
+  search.rect = GetClusterRect(GetClusterIndex(NavGraph::GetPoint(index)));
+
+  std::fill(std::begin(search.costs), std::end(search.costs), kInfiniteCost);
+  std::fill(std::begin(search.parents), std::end(search.parents), kNoParent);
+
+  search.costs[search.GetLocalIndex(index)] = 0.0f;
+
+  auto get_cost = [&search](u32 node_index) { return search.costs[search.GetLocalIndex(node_index)]; };
+
+  auto set_cost = [&search](u32 node_index, float cost, u32 parent_index, size_t) {
+    size_t local_index = search.GetLocalIndex(node_index);
+
+    search.costs[local_index] = cost;
+    search.parents[local_index] = (u16)search.GetLocalIndex(parent_index);
+  };
+
+  SearchGraph(processor_.GetGraph(), index, false, search.rect, kInfiniteCost, get_cost, set_cost,
+              [](float cost) { return cost; });
+}
+
+bool ClusterGraph::FindPath(NodePoint start, NodePoint goal, std::vector<NodePoint>& points) const {
+  using Entry = std::pair<float, u32>;
+
+  const NavGraph& graph = processor_.GetGraph();
+  u32 start_index = NavGraph::GetIndex(start);
+  u32 goal_index = NavGraph::GetIndex(goal);
+  u32 start_cluster = GetClusterIndex(start);
+  u32 goal_cluster = GetClusterIndex(goal);
+
+  // The start and goal aren't entrances, so every node in their clusters is searched like a normal search. That
+  // connects them to the entrances without searching the rest of those clusters. Those nodes come first in the search
+  // state, followed by the entrances of every other cluster.
+  auto is_searched_cluster = [start_cluster, goal_cluster](u32 cluster_index) {
+    return cluster_index == start_cluster || cluster_index == goal_cluster;
+  };
+
+  // The entrance id is only used when the node is an entrance outside of the searched clusters.
+  auto get_search_id = [&](u32 index, u32 entrance_id) -> u32 {
+    NodePoint point = NavGraph::GetPoint(index);
+    u32 cluster_index = GetClusterIndex(point);
+    u32 local_index = (point.y % kClusterSize) * kClusterSize + point.x % kClusterSize;
+
+    if (cluster_index == start_cluster) return local_index;
+    if (cluster_index == goal_cluster) return (u32)kClusterNodeCount + local_index;
+
+    return (u32)kClusterNodeCount * 2 + entrance_id;
+  };
+
+  std::vector<SearchNode> nodes(kClusterNodeCount * 2 + entrance_offsets_.back());
+  std::vector<Entry> openset;
+
+  u32 start_id = get_search_id(start_index, 0);
+  u32 goal_id = get_search_id(goal_index, 0);
+
+  // Every edge costs at least the distance between its nodes, so closed nodes never need to be reopened.
+  auto open_node = [&](u32 parent_id, u32 id, u32 index, float cost) {
+    SearchNode& node = nodes[id];
+
+    if (node.state == SearchNode::Closed) return;
+    if (node.state == SearchNode::Open && cost >= node.g) return;
+
+    node.g = cost;
+    node.f = cost + GetDistance(NavGraph::GetPoint(index), goal);
+    node.parent = parent_id;
+    node.index = index;
+    node.state = SearchNode::Open;
+
+    openset.push_back({node.f, id});
+    std::push_heap(openset.begin(), openset.end(), std::greater<Entry>());
+  };
+
+  open_node(kNoSearchNode, start_id, start_index, 0.0f);
+
+  while (!openset.empty()) {
+    std::pop_heap(openset.begin(), openset.end(), std::greater<Entry>());
+    Entry entry = openset.back();
+    openset.pop_back();
+
+    u32 node_id = entry.second;
+    SearchNode& node = nodes[node_id];
+
+    // The node was opened again with a lower cost after this entry was added.
+    if (node.state == SearchNode::Closed || entry.first != node.f) continue;
+    if (node_id == goal_id) break;
+
+    node.state = SearchNode::Closed;
+
+    u32 node_index = node.index;
+    float node_cost = node.g;
+    NodePoint node_point = NavGraph::GetPoint(node_index);
+    u32 cluster_index = GetClusterIndex(node_point);
+    const Cluster& cluster = clusters_[cluster_index];
+    int entrance_index = -1;
+
+    if (is_searched_cluster(cluster_index)) {
+      EdgeSet edges = graph.edges[node_index];
+      s32 local_x = node_point.x % kClusterSize;
+      s32 local_y = node_point.y % kClusterSize;
+
+      for (size_t i = 0; i < 8; ++i) {
+        if (!edges.IsSet(i)) continue;
+
+        CoordOffset offset = CoordOffset::FromIndex(i);
+        s32 x = local_x + offset.x;
+        s32 y = local_y + offset.y;
+
+        // Leaving the cluster is only done through the entrance links.
+        if (x < 0 || y < 0 || x >= kClusterSize || y >= kClusterSize) continue;
+
+        u32 edge_index = NavGraph::GetIndex(NodePoint(node_point.x + offset.x, node_point.y + offset.y));
+        u32 edge_id = node_id - (u32)(local_y * kClusterSize + local_x) + (u32)(y * kClusterSize + x);
+
+        open_node(node_id, edge_id, edge_index, node_cost + graph.weights[edge_index] * CoordOffset::GetDistance(i));
+      }
+
+      // Only the nodes on the border of the cluster can be entrances.
+      if (local_x == 0 || local_y == 0 || local_x == kClusterSize - 1 || local_y == kClusterSize - 1) {
+        entrance_index = cluster.FindEntrance(node_index);
+      }
+    } else {
+      u32 first_id = (u32)kClusterNodeCount * 2 + entrance_offsets_[cluster_index];
+      size_t count = cluster.entrances.size();
+
+      entrance_index = (int)(node_id - first_id);
+
+      for (size_t i = 0; i < count; ++i) {
+        float cost = cluster.costs[entrance_index * count + i];
+
+        if (cost != kInfiniteCost) {
+          open_node(node_id, first_id + (u32)i, cluster.entrances[i].index, node_cost + cost);
+        }
+      }
+    }
+
+    if (entrance_index >= 0) {
+      const Entrance& entrance = cluster.entrances[entrance_index];
+
+      for (size_t i = 0; i < entrance.link_count; ++i) {
+        const Link& link = entrance.links[i];
+
+        open_node(node_id, get_search_id(link.index, link.entrance_id), link.index, node_cost + link.cost);
+      }
+    }
+  }
+
+  if (nodes[goal_id].state != SearchNode::Open) return false;
+
+  // Collect the abstract path backwards, then fill in the nodes of the cached paths between entrances.
+  std::vector<u32> abstract_path;
+
+  for (u32 id = goal_id; id != kNoSearchNode; id = nodes[id].parent) {
+    abstract_path.push_back(nodes[id].index);
+  }
+
+  std::reverse(abstract_path.begin(), abstract_path.end());
+
+  for (size_t i = 1; i < abstract_path.size(); ++i) {
+    u32 from_index = abstract_path[i - 1];
+    u32 to_index = abstract_path[i];
+    u32 from_cluster = GetClusterIndex(NavGraph::GetPoint(from_index));
+    u32 to_cluster = GetClusterIndex(NavGraph::GetPoint(to_index));
+
+    // Links across borders and edges in the searched clusters go straight to the next node.
+    if (from_cluster != to_cluster || is_searched_cluster(from_cluster)) {
+      points.push_back(NavGraph::GetPoint(to_index));
+      continue;
+    }
+
+    const Cluster& cluster = clusters_[from_cluster];
+    size_t count = cluster.entrances.size();
+    size_t path_index = cluster.FindEntrance(from_index) * count + cluster.FindEntrance(to_index);
+
+    for (u32 j = cluster.path_offsets[path_index]; j < cluster.path_offsets[path_index + 1]; ++j) {
+      points.push_back(NavGraph::GetPoint(cluster.path_nodes[j]));
+    }
+  }
+
+  return true;
+}
+
+}  // namespace path
+}  // namespace elm
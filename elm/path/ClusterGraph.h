@@ -0,0 +1,149 @@
+#pragma once
+
+#include <elm/Map.h>
+#include <elm/Types.h>
+#include <elm/path/NodeProcessor.h>
+
+#include <cstdlib>
+#include <vector>
+
+namespace elm {
+namespace path {
+
+// Abstract graph over fixed clusters of nodes for hierarchical searches (HPA*).
+// Every run of nodes that can cross a cluster border gets an entrance on each side of it, and the cheapest path
+// between each pair of entrances inside a cluster is cached. A long search only crosses the entrances and joins the
+// cached paths together. The paths can cost a little more than the best path because they have to go through the
+// entrances.
+class ClusterGraph {
+ public:
+  static constexpr s32 kClusterSize = 32;
+  static constexpr s32 kClustersPerRow = 1024 / kClusterSize;
+  static constexpr size_t kClusterCount = kClustersPerRow * kClustersPerRow;
+
+  ClusterGraph(const NodeProcessor& processor);
+
+  // Builds every border and cluster from the processor's graph.
+  void Build();
+  // Rebuilds the borders and clusters around the rect of nodes whose navigation data changed.
+  void Update(const MapRect& rect);
+
+  // Finds a path between nodes in different clusters. The nodes after the start up to and including the goal are
+  // appended to points in order. Returns false if the goal can't be reached through the entrances.
+  // The search state is small enough to keep on its own, so this can run on multiple threads at once.
+  bool FindPath(NodePoint start, NodePoint goal, std::vector<NodePoint>& points) const;
+
+  // Searches between the points are only done with the abstract graph when their clusters aren't touching, because
+  // the entrances around the start and goal make short paths worse.
+  static inline bool IsDistant(NodePoint start, NodePoint goal) {
+    s32 dx = std::abs(start.x / kClusterSize - goal.x / kClusterSize);
+    s32 dy = std::abs(start.y / kClusterSize - goal.y / kClusterSize);
+
+    return dx > 1 || dy > 1;
+  }
+
+  static inline u32 GetClusterIndex(NodePoint point) {
+    return (u32)(point.y / kClusterSize) * kClustersPerRow + point.x / kClusterSize;
+  }
+
+ private:
+  static constexpr size_t kClusterNodeCount = kClusterSize * kClusterSize;
+  static constexpr u16 kNoParent = 0xFFFF;
+  static constexpr u32 kNoSearchNode = 0xFFFFFFFF;
+
+  // Edge to the entrance on the other side of a border.
+  struct Link {
+    u32 index;
+    float cost;
+    // The abstract search node of the entrance that this links to.
+    u32 entrance_id;
+  };
+
+  struct Entrance {
+    u32 index;
+    // A node in the corner of a cluster can be an entrance on two borders.
+    Link links[2];
+    size_t link_count;
+  };
+
+  struct Cluster {
+    std::vector<Entrance> entrances;
+    // The cost from entrance i to entrance j is at i * count + j. Entrances that can't reach each other inside the
+    // cluster have an infinite cost.
+    std::vector<float> costs;
+    // The nodes on the path from entrance i to entrance j, not including i, are path_nodes[path_offsets[i * count + j]]
+    // up to path_nodes[path_offsets[i * count + j + 1]].
+    std::vector<u32> path_offsets;
+    std::vector<u32> path_nodes;
+
+    int FindEntrance(u32 index) const {
+      for (size_t i = 0; i < entrances.size(); ++i) {
+        if (entrances[i].index == index) return (int)i;
+      }
+
+      return -1;
+    }
+  };
+
+  // A pair of entrances across a border. The first node is in the cluster to the west or north.
+  struct Transition {
+    u32 first;
+    u32 second;
+  };
+
+  // The state of a node in the abstract search.
+  struct SearchNode {
+    enum { Unvisited, Open, Closed };
+
+    float g;
+    float f;
+    u32 parent;
+    u32 index;
+    u32 state;
+  };
+
+  // The cheapest costs between one node and every node in its cluster.
+  struct ClusterSearch {
+    MapRect rect;
+    float costs[kClusterNodeCount];
+    // The next node towards the node that was searched from, as an index in the cluster.
+    u16 parents[kClusterNodeCount];
+
+    inline size_t GetLocalIndex(u32 index) const {
+      NodePoint point = NavGraph::GetPoint(index);
+      return (size_t)(point.y - rect.start_y) * kClusterSize + (point.x - rect.start_x);
+    }
+
+    inline u32 GetIndex(size_t local_index) const {
+      return NavGraph::GetIndex(NodePoint((u16)(rect.start_x + local_index % kClusterSize),
+                                          (u16)(rect.start_y + local_index / kClusterSize)));
+    }
+  };
+
+  static inline MapRect GetClusterRect(u32 cluster_index) {
+    s32 x = (s32)(cluster_index % kClustersPerRow) * kClusterSize;
+    s32 y = (s32)(cluster_index / kClustersPerRow) * kClusterSize;
+
+    return MapRect(x, y, x + kClusterSize - 1, y + kClusterSize - 1);
+  }
+
+  // Finds the transitions across the east border of the cluster when vertical is set, or the south border otherwise.
+  void BuildBorder(u32 cluster_index, bool vertical);
+  void BuildCluster(u32 cluster_index);
+  void UpdateEntranceIds();
+
+  // Calculates the cost from the node to every node in its cluster without leaving the cluster.
+  void SearchCluster(u32 index, ClusterSearch& search) const;
+
+  const NodeProcessor& processor_;
+
+  std::vector<Cluster> clusters_;
+  std::vector<std::vector<Transition>> east_borders_;
+  std::vector<std::vector<Transition>> south_borders_;
+  // The number of entrances in the clusters before each cluster, so every entrance has its own abstract search node.
+  // The links are resolved to those nodes whenever the offsets change.
+  std::vector<u32> entrance_offsets_;
+};
+
+}  // namespace path
+}  // namespace elm
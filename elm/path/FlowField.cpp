@@ -0,0 +1,48 @@
+#include "FlowField.h"
+
+#include <algorithm>
+
+namespace elm {
+namespace path {
+
+FlowField::FlowField(const NodeProcessor& processor)
+    : processor_(processor), costs_(kMaxNodes), directions_(kMaxNodes), generations_(kMaxNodes, 0) {}
+
+void FlowField::Build(NodePoint goal, float max_cost) {
+  const NavGraph& graph = processor_.GetGraph();
+
+  goal_ = goal;
+  max_cost_ = max_cost;
+
+  if (++generation_ == 0) {
+    // The generation wrapped around, so old generations could match again.
+    std::fill(generations_.begin(), generations_.end(), 0);
+    generation_ = 1;
+  }
+
+  if (goal.x >= 1024 || goal.y >= 1024) return;
+
+  u32 goal_index = NavGraph::GetIndex(goal);
+
+  if (!graph.IsTraversable(goal_index)) return;
+
+  costs_[goal_index] = 0.0f;
+  directions_[goal_index] = kNoDirection;
+  generations_[goal_index] = generation_;
+
+  // Nodes from an older build haven't been reached yet.
+  auto get_cost = [this](u32 index) { return generations_[index] == generation_ ? costs_[index] : kInfiniteCost; };
+
+  auto set_cost = [this](u32 index, float cost, u32, size_t direction) {
+    costs_[index] = cost;
+    directions_[index] = (u8)direction;
+    generations_[index] = generation_;
+  };
+
+  // Follow the edges that lead into each node backwards, so the directions lead towards the goal.
+  SearchGraph(graph, goal_index, true, MapRect(0, 0, 1023, 1023), max_cost, get_cost, set_cost,
+              [](float cost) { return cost; });
+}
+
+}  // namespace path
+}  // namespace elm
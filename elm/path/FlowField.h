@@ -0,0 +1,79 @@
+#pragma once
+
+#include <elm/Types.h>
+#include <elm/path/NodeProcessor.h>
+
+#include <limits>
+#include <vector>
+
+namespace elm {
+namespace path {
+
+// The cost from every node to one goal and the first step each node takes towards it.
+// Many ships going to the same goal can share one field instead of each searching for its own path, and reading the
+// next step from a node doesn't search at all. The field is built from the processor's graph, so it needs to be built
+// again after the graph changes.
+class FlowField {
+ public:
+  static constexpr u8 kNoDirection = 0xFF;
+
+  FlowField(const NodeProcessor& processor);
+
+  // Calculates the field for the goal with a reverse search over the graph. Only the nodes that reach the goal with a
+  // cost of at most max_cost are in the field, which keeps the search near the goal when the ships are known to be
+  // close to it.
+  void Build(NodePoint goal, float max_cost = std::numeric_limits<float>::infinity());
+  // Builds the field again for a goal that moved, with the max cost from the last build. Each build only touches the
+  // nodes that it reaches, so a bounded field around a moving goal stays cheap to keep updated.
+  void MoveGoal(NodePoint goal) { Build(goal, max_cost_); }
+
+  inline NodePoint GetGoal() const { return goal_; }
+
+  inline bool Contains(NodePoint point) const {
+    if (point.x >= 1024 || point.y >= 1024) return false;
+
+    u32 index = NavGraph::GetIndex(point);
+
+    // Nodes that were still open when the build reached the max cost might not have their best cost.
+    return generations_[index] == generation_ && costs_[index] <= max_cost_;
+  }
+
+  // The cost of the path from the node to the goal, or infinity if the node isn't in the field.
+  inline float GetCost(NodePoint point) const {
+    return Contains(point) ? costs_[NavGraph::GetIndex(point)] : std::numeric_limits<float>::infinity();
+  }
+
+  // The CoordOffset index of the first step from the node towards the goal. The goal and nodes that aren't in the
+  // field don't have a direction.
+  inline u8 GetDirection(NodePoint point) const {
+    return Contains(point) ? directions_[NavGraph::GetIndex(point)] : kNoDirection;
+  }
+
+  // Finds the next node after the point on the way to the goal. Returns false if there is no next node.
+  inline bool GetNextPoint(NodePoint point, NodePoint* next) const {
+    u8 direction = GetDirection(point);
+
+    if (direction == kNoDirection) return false;
+
+    CoordOffset offset = CoordOffset::FromIndex(direction);
+    *next = NodePoint(point.x + offset.x, point.y + offset.y);
+
+    return true;
+  }
+
+ private:
+  const NodeProcessor& processor_;
+
+  NodePoint goal_;
+  float max_cost_ = std::numeric_limits<float>::infinity();
+
+  std::vector<float> costs_;
+  std::vector<u8> directions_;
+  // A node is only in the field if it was reached by the build with the current generation, so nothing needs to be
+  // cleared between builds.
+  std::vector<u32> generations_;
+  u32 generation_ = 0;
+};
+
+}  // namespace path
+}  // namespace elm
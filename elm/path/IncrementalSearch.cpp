@@ -0,0 +1,369 @@
+#include "IncrementalSearch.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace elm {
+namespace path {
+
+static inline float GetDistance(NodePoint from, NodePoint to) {
+  float dx = (float)(from.x - to.x);
+  float dy = (float)(from.y - to.y);
+
+  return std::sqrt(dx * dx + dy * dy);
+}
+
+static inline bool IsKeyLess(const float* lhs, const float* rhs) {
+  return lhs[0] < rhs[0] || (lhs[0] == rhs[0] && lhs[1] < rhs[1]);
+}
+
+IncrementalSearch::IncrementalSearch(const NodeProcessor& processor) : processor_(processor), nodes_(kMaxNodes) {}
+
+std::vector<Vector2f> IncrementalSearch::FindPath(NodePoint start, NodePoint goal, float ship_radius) {
+  std::vector<Vector2f> path;
+
+  if (start.x >= 1024 || start.y >= 1024 || goal.x >= 1024 || goal.y >= 1024) return path;
+
+  u32 start_index = NavGraph::GetIndex(start);
+  u32 goal_index = NavGraph::GetIndex(goal);
+
+  if (!processor_.IsTraversable(start_index) || !processor_.IsTraversable(goal_index)) return path;
+
+  // Every key in the open set is too low by at most how far the goal moved, so raising the new keys by that keeps the
+  // open set in order without recalculating it.
+  if (has_tree_ && goal_index != goal_index_) {
+    key_modifier_ += GetDistance(goal_point_, goal);
+  }
+
+  goal_index_ = goal_index;
+  goal_point_ = goal;
+
+  const SearchNode& start_node = nodes_[start_index];
+  bool in_tree = start_node.generation == generation_ && std::min(start_node.g, start_node.rhs) != kInfiniteCost;
+
+  if (!has_tree_ || !in_tree) {
+    StartTree(start_index);
+  } else if (start_index != start_index_) {
+    MoveStart(start_index);
+  }
+
+  ComputePath();
+
+  const SearchNode& goal_node = GetNode(goal_index);
+
+  if (goal_index == start_index || goal_node.rhs == kInfiniteCost) return path;
+
+  // Construct path backwards from goal node
+  std::vector<NodePoint> points;
+
+  for (u32 index = goal_index; index != start_index; index = nodes_[index].parent) {
+    // Every node on the path is in the tree, so a longer walk means the parents loop and there is no path to return.
+    if (index == kInvalidNodeIndex || points.size() >= touched_.size()) return path;
+
+    points.push_back(NavGraph::GetPoint(index));
+  }
+
+  path.reserve(points.size() + 1);
+  path.push_back(Vector2f(start.x + 0.5f, start.y + 0.5f));
+
+  for (auto iter = points.rbegin(); iter != points.rend(); ++iter) {
+    path.push_back(processor_.map_.GetOccupyCenter(Vector2f(iter->x, iter->y), ship_radius));
+  }
+
+  return path;
+}
+
+void IncrementalSearch::UpdateEdges(const MapRect& rect) {
+  if (!has_tree_) return;
+
+  // The cost of an edge is the weight of the node it moves into, so the nodes next to the rect can have changed edges
+  // leading into them too.
+  s32 start_x = std::max(rect.start_x - 1, 0);
+  s32 start_y = std::max(rect.start_y - 1, 0);
+  s32 end_x = std::min(rect.end_x + 1, 1023);
+  s32 end_y = std::min(rect.end_y + 1, 1023);
+
+  for (s32 y = start_y; y <= end_y; ++y) {
+    for (s32 x = start_x; x <= end_x; ++x) {
+      u32 index = NavGraph::GetIndex(NodePoint((u16)x, (u16)y));
+
+      if (index == start_index_) continue;
+
+      SearchNode& node = GetNode(index);
+
+      UpdateRhs(node);
+      UpdateOpenset(node);
+    }
+  }
+}
+
+IncrementalSearch::SearchNode& IncrementalSearch::GetNode(u32 index) {
+  SearchNode& node = nodes_[index];
+
+  if (node.generation != generation_) {
+    node.g = node.rhs = kInfiniteCost;
+    node.parent = kInvalidNodeIndex;
+    node.flags = 0;
+    node.generation = generation_;
+
+    touched_.push_back(index);
+  }
+
+  return node;
+}
+
+void IncrementalSearch::StartTree(u32 start_index) {
+  if (++generation_ == 0) {
+    // The generation wrapped around, so old generations could match again.
+    for (SearchNode& node : nodes_) {
+      node.generation = 0;
+    }
+
+    generation_ = 1;
+  }
+
+  touched_.clear();
+  openset_.Clear();
+
+  key_modifier_ = 0.0f;
+  start_index_ = start_index;
+  has_tree_ = true;
+
+  SearchNode& start = GetNode(start_index);
+
+  start.rhs = 0.0f;
+  UpdateOpenset(start);
+}
+
+void IncrementalSearch::MoveStart(u32 start_index) {
+  SearchNode& root = nodes_[start_index];
+
+  start_index_ = start_index;
+
+  // The root can keep any cost, so it keeps the one it had and the costs of the nodes reached through it stay correct.
+  root.parent = kInvalidNodeIndex;
+  root.rhs = std::min(root.g, root.rhs);
+  UpdateOpenset(root);
+
+  // Find which nodes are still reached through the new root by following their parents up the tree.
+  std::vector<u32> chain;
+
+  for (u32 index : touched_) {
+    u32 current = index;
+    bool in_subtree = false;
+
+    chain.clear();
+
+    while (true) {
+      SearchNode& node = nodes_[current];
+
+      if (node.flags & Flag_InSubtree) {
+        in_subtree = true;
+        break;
+      }
+
+      // A parent that is being visited is a loop, which can't lead back to the root.
+      if (node.flags & (Flag_OutOfSubtree | Flag_Visiting)) break;
+
+      node.flags |= Flag_Visiting;
+      chain.push_back(current);
+
+      if (current == start_index) {
+        in_subtree = true;
+        break;
+      }
+
+      if (node.parent == kInvalidNodeIndex) break;
+
+      current = node.parent;
+    }
+
+    for (u32 chain_index : chain) {
+      SearchNode& node = nodes_[chain_index];
+
+      node.flags &= ~Flag_Visiting;
+      node.flags |= in_subtree ? Flag_InSubtree : Flag_OutOfSubtree;
+    }
+  }
+
+  // Clear everything else. Those nodes can still be reached from the nodes that are left, so they get a new cost from
+  // them and are searched again.
+  std::vector<u32> deleted;
+
+  for (u32 index : touched_) {
+    SearchNode& node = nodes_[index];
+
+    if (node.flags & Flag_InSubtree) continue;
+
+    node.g = node.rhs = kInfiniteCost;
+    node.parent = kInvalidNodeIndex;
+
+    if (node.flags & Flag_Openset) {
+      openset_.Remove(&node);
+      node.flags &= ~Flag_Openset;
+    }
+
+    deleted.push_back(index);
+  }
+
+  for (u32 index : deleted) {
+    SearchNode& node = nodes_[index];
+
+    UpdateRhs(node);
+    UpdateOpenset(node);
+  }
+
+  // Only keep the nodes that still have a cost. The rest are made stale, so they are added again if they are reached.
+  size_t kept = 0;
+
+  for (u32 index : touched_) {
+    SearchNode& node = nodes_[index];
+
+    node.flags &= ~(Flag_InSubtree | Flag_OutOfSubtree);
+
+    if (std::min(node.g, node.rhs) == kInfiniteCost && !(node.flags & Flag_Openset)) {
+      node.generation = 0;
+    } else {
+      touched_[kept++] = index;
+    }
+  }
+
+  touched_.resize(kept);
+}
+
+void IncrementalSearch::ComputePath() {
+  const NavGraph& graph = processor_.GetGraph();
+  SearchNode& goal = GetNode(goal_index_);
+
+  while (!openset_.Empty()) {
+    SearchNode* node = openset_.Top();
+    float goal_key[2];
+
+    CalculateKey(goal, goal_key);
+
+    if (!IsKeyLess(node->key, goal_key) && goal.rhs <= goal.g) break;
+
+    float key[2];
+
+    CalculateKey(*node, key);
+
+    // The key was calculated before the goal moved, so it goes back in with the current one.
+    if (IsKeyLess(node->key, key)) {
+      node->key[0] = key[0];
+      node->key[1] = key[1];
+      openset_.Update(node);
+      continue;
+    }
+
+    u32 node_index = GetIndex(*node);
+    NodePoint point = NavGraph::GetPoint(node_index);
+    EdgeSet edges = graph.edges[node_index];
+
+    openset_.Pop();
+    node->flags &= ~Flag_Openset;
+
+    if (node->g > node->rhs) {
+      // The node's cost went down, so the nodes after it can be reached more cheaply.
+      node->g = node->rhs;
+
+      for (size_t i = 0; i < 8; ++i) {
+        if (!edges.IsSet(i)) continue;
+
+        CoordOffset offset = CoordOffset::FromIndex(i);
+        u32 edge_index = NavGraph::GetIndex(NodePoint(point.x + offset.x, point.y + offset.y));
+
+        if (edge_index == start_index_) continue;
+
+        SearchNode& edge = GetNode(edge_index);
+        float cost = node->g + graph.weights[edge_index] * CoordOffset::GetDistance(i);
+
+        if (cost < edge.rhs) {
+          edge.rhs = cost;
+          edge.parent = node_index;
+          UpdateOpenset(edge);
+        }
+      }
+    } else {
+      // The node's cost went up, so every node that went through it needs a new parent.
+      node->g = kInfiniteCost;
+
+      UpdateOpenset(*node);
+
+      for (size_t i = 0; i < 8; ++i) {
+        if (!edges.IsSet(i)) continue;
+
+        CoordOffset offset = CoordOffset::FromIndex(i);
+        u32 edge_index = NavGraph::GetIndex(NodePoint(point.x + offset.x, point.y + offset.y));
+
+        if (edge_index == start_index_) continue;
+
+        SearchNode& edge = GetNode(edge_index);
+
+        if (edge.parent == node_index) {
+          UpdateRhs(edge);
+          UpdateOpenset(edge);
+        }
+      }
+    }
+  }
+}
+
+void IncrementalSearch::UpdateRhs(SearchNode& node) {
+  const NavGraph& graph = processor_.GetGraph();
+  u32 index = GetIndex(node);
+  NodePoint point = NavGraph::GetPoint(index);
+  float weight = graph.weights[index];
+
+  node.rhs = kInfiniteCost;
+  node.parent = kInvalidNodeIndex;
+
+  for (size_t i = 0; i < 8; ++i) {
+    CoordOffset offset = CoordOffset::FromIndex(i);
+    s32 x = point.x - offset.x;
+    s32 y = point.y - offset.y;
+
+    if (x < 0 || y < 0 || x >= 1024 || y >= 1024) continue;
+
+    u32 from_index = NavGraph::GetIndex(NodePoint((u16)x, (u16)y));
+
+    if (!graph.edges[from_index].IsSet(i)) continue;
+
+    // Stale nodes haven't been reached, so they don't have a cost.
+    const SearchNode& from = nodes_[from_index];
+
+    if (from.generation != generation_ || from.g == kInfiniteCost) continue;
+
+    float cost = from.g + weight * CoordOffset::GetDistance(i);
+
+    if (cost < node.rhs) {
+      node.rhs = cost;
+      node.parent = from_index;
+    }
+  }
+}
+
+void IncrementalSearch::UpdateOpenset(SearchNode& node) {
+  if (node.g != node.rhs) {
+    CalculateKey(node, node.key);
+
+    if (node.flags & Flag_Openset) {
+      openset_.Update(&node);
+    } else {
+      node.flags |= Flag_Openset;
+      openset_.Push(&node);
+    }
+  } else if (node.flags & Flag_Openset) {
+    openset_.Remove(&node);
+    node.flags &= ~Flag_Openset;
+  }
+}
+
+inline void IncrementalSearch::CalculateKey(const SearchNode& node, float* key) const {
+  float cost = std::min(node.g, node.rhs);
+
+  key[0] = cost + GetDistance(NavGraph::GetPoint(GetIndex(node)), goal_point_) + key_modifier_;
+  key[1] = cost;
+}
+
+}  // namespace path
+}  // namespace elm
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <elm/Math.h>
+#include <elm/Types.h>
+#include <elm/path/NodeProcessor.h>
+#include <elm/path/Pathfinder.h>
+
+#include <vector>
+
+namespace elm {
+namespace path {
+
+// Search that keeps its tree between calls and only repairs the parts that changed (Moving Target D* Lite).
+// The tree grows forward from the start. A goal that moves only changes the heuristic, which is handled by raising
+// every later key by how far the goal moved instead of recalculating the keys in the open set. A start that moves
+// inside of the tree becomes its root with the cost it already had, so only the nodes that weren't reached through it
+// are cleared and searched again. Changed edges only update the nodes around them.
+class IncrementalSearch {
+ public:
+  IncrementalSearch(const NodeProcessor& processor);
+
+  // Finds the path from the start to the goal in the same form as Pathfinder::FindPath, reusing the tree from the last
+  // call when the start is still in it.
+  std::vector<Vector2f> FindPath(NodePoint start, NodePoint goal, float ship_radius);
+
+  // Updates the nodes whose edges or weights changed in the rect, so the next search repairs the paths through them.
+  void UpdateEdges(const MapRect& rect);
+
+  // Throws away the tree so the next search starts over.
+  void Reset() { has_tree_ = false; }
+
+ private:
+  struct SearchNode {
+    float g;
+    float rhs;
+    float key[2];
+    u32 parent;
+    u32 heap_index;
+    u32 generation;
+    u32 flags;
+  };
+
+  enum {
+    Flag_Openset = (1 << 0),
+    // Set while the subtree of the new start is being found.
+    Flag_Visiting = (1 << 1),
+    Flag_InSubtree = (1 << 2),
+    Flag_OutOfSubtree = (1 << 3),
+  };
+
+  struct KeyCompare {
+    bool operator()(const SearchNode* lhs, const SearchNode* rhs) const {
+      if (lhs->key[0] != rhs->key[0]) return lhs->key[0] > rhs->key[0];
+      return lhs->key[1] > rhs->key[1];
+    }
+  };
+
+  struct HeapIndex {
+    u32 Get(const SearchNode* node) const { return node->heap_index; }
+    void Set(SearchNode* node, u32 index) const { node->heap_index = index; }
+  };
+
+  // Returns the node's state, resetting it first if it's from an older tree.
+  SearchNode& GetNode(u32 index);
+  inline u32 GetIndex(const SearchNode& node) const { return (u32)(&node - nodes_.data()); }
+
+  void StartTree(u32 start_index);
+  // Makes the new start the root of the tree and clears the nodes that aren't reached through it.
+  void MoveStart(u32 start_index);
+  void ComputePath();
+
+  // Recalculates the node's cheapest cost from its predecessors and picks the cheapest one as its parent.
+  void UpdateRhs(SearchNode& node);
+  // Adds, moves or removes the node in the open set depending on if it's consistent.
+  void UpdateOpenset(SearchNode& node);
+
+  inline void CalculateKey(const SearchNode& node, float* key) const;
+
+  const NodeProcessor& processor_;
+
+  std::vector<SearchNode> nodes_;
+  // Every node that the current tree has touched, so the tree can be walked without scanning every node.
+  std::vector<u32> touched_;
+  IndexedPriorityQueue<SearchNode*, KeyCompare, HeapIndex> openset_;
+  u32 generation_ = 0;
+
+  bool has_tree_ = false;
+  u32 start_index_ = 0;
+  u32 goal_index_ = 0;
+  NodePoint goal_point_;
+  // The distance that the goal moved since the tree was started, which is added to every key.
+  float key_modifier_ = 0.0f;
+};
+
+}  // namespace path
+}  // namespace elm
@@ -0,0 +1,156 @@
+#include "Landmarks.h"
+
+#include <elm/ThreadPool.h>
+
+#include <limits>
+#include <memory>
+
+namespace elm {
+namespace path {
+
+Landmarks::Landmarks(const NodeProcessor& processor) : processor_(processor) {}
+
+void Landmarks::Build(size_t count, ThreadPool* pool) {
+  const NavGraph& graph = processor_.GetGraph();
+
+  count = std::min(count, kMaxLandmarks);
+
+  nodes_.clear();
+  scales_.assign(count * 2, 1.0f);
+  stride_ = count * 2;
+  costs_.assign(kMaxNodes * stride_, kUnreachable);
+  current_ = true;
+
+  // Start from the traversable node closest to the center of the map. It's only used to find the first landmark.
+  u32 seed = 0;
+  s32 seed_distance_sq = std::numeric_limits<s32>::max();
+
+  for (u32 index = 0; index < kMaxNodes; ++index) {
+    if (!graph.IsTraversable(index)) continue;
+
+    NodePoint point = NavGraph::GetPoint(index);
+    s32 dx = point.x - 512;
+    s32 dy = point.y - 512;
+
+    if (dx * dx + dy * dy < seed_distance_sq) {
+      seed_distance_sq = dx * dx + dy * dy;
+      seed = index;
+    }
+  }
+
+  if (count == 0 || seed_distance_sq == std::numeric_limits<s32>::max()) return;
+
+  // Each landmark is the node that costs the most to reach from the closest landmark picked so far, so they end up
+  // spread around the edges of the area reachable from the seed.
+  std::vector<float> costs;
+  std::vector<float> nearest(kMaxNodes, kInfiniteCost);
+
+  auto find_farthest = [](const std::vector<float>& costs, u32* farthest) {
+    float farthest_cost = 0.0f;
+
+    for (u32 index = 0; index < kMaxNodes; ++index) {
+      if (costs[index] != kInfiniteCost && costs[index] > farthest_cost) {
+        farthest_cost = costs[index];
+        *farthest = index;
+      }
+    }
+
+    return farthest_cost > 0.0f;
+  };
+
+  Search(seed, false, costs);
+
+  u32 landmark = seed;
+
+  if (!find_farthest(costs, &landmark)) return;
+
+  while (nodes_.size() < count) {
+    nodes_.push_back(landmark);
+
+    Search(landmark, false, costs);
+    SetScale(nodes_.size() - 1, false, costs);
+
+    for (u32 index = 0; index < kMaxNodes; ++index) {
+      nearest[index] = std::min(nearest[index], costs[index]);
+    }
+
+    if (!find_farthest(nearest, &landmark)) break;
+  }
+
+  // The stored costs and the reverse searches don't pick anything, so they can all run at once. Each job is one of a
+  // landmark's forward or reverse costs, in the same order as the slots.
+  auto job = [this](size_t, size_t slot) {
+    size_t landmark_index = slot / 2;
+    bool reverse = (slot & 1) != 0;
+
+    if (reverse) {
+      std::vector<float> reverse_costs;
+
+      Search(nodes_[landmark_index], true, reverse_costs);
+      SetScale(landmark_index, true, reverse_costs);
+    }
+
+    Store(landmark_index, reverse);
+  };
+
+  if (pool) {
+    pool->Run(nodes_.size() * 2, job);
+  } else {
+    for (size_t i = 0; i < nodes_.size() * 2; ++i) {
+      job(0, i);
+    }
+  }
+}
+
+void Landmarks::Search(u32 index, bool reverse, std::vector<float>& costs) const {
+  costs.assign(kMaxNodes, kInfiniteCost);
+  costs[index] = 0.0f;
+
+  auto get_cost = [&costs](u32 node_index) { return costs[node_index]; };
+  auto set_cost = [&costs](u32 node_index, float cost, u32, size_t) { costs[node_index] = cost; };
+
+  SearchGraph(processor_.GetGraph(), index, reverse, MapRect(0, 0, 1023, 1023), kInfiniteCost, get_cost, set_cost,
+              [](float cost) { return cost; });
+}
+
+void Landmarks::SetScale(size_t landmark, bool reverse, const std::vector<float>& costs) {
+  float max_cost = 0.0f;
+
+  for (float cost : costs) {
+    if (cost != kInfiniteCost) {
+      max_cost = std::max(max_cost, cost);
+    }
+  }
+
+  // Rounding each edge down can only make the quantized costs smaller than the real costs in steps, so the largest one
+  // fits. One step is left spare for float error so it never reaches the unreachable value.
+  scales_[landmark * 2 + (reverse ? 1 : 0)] = max_cost > 0.0f ? max_cost / (kUnreachable - 2) : 1.0f;
+}
+
+void Landmarks::Store(size_t landmark, bool reverse) {
+  constexpr u32 kInfiniteSteps = std::numeric_limits<u32>::max();
+
+  size_t slot = landmark * 2 + (reverse ? 1 : 0);
+  float step_scale = 1.0f / scales_[slot];
+
+  // This is the same search as Search, but in whole steps with every edge cost rounded down.
+  std::vector<u32> costs(kMaxNodes, kInfiniteSteps);
+  u32 index = nodes_[landmark];
+
+  costs[index] = 0;
+
+  auto get_cost = [&costs](u32 node_index) { return costs[node_index]; };
+  auto set_cost = [&costs](u32 node_index, u32 cost, u32, size_t) { costs[node_index] = cost; };
+
+  SearchGraph(processor_.GetGraph(), index, reverse, MapRect(0, 0, 1023, 1023), kInfiniteSteps, get_cost, set_cost,
+              [step_scale](float cost) { return (u32)(cost * step_scale); });
+
+  for (size_t node_index = 0; node_index < kMaxNodes; ++node_index) {
+    if (costs[node_index] == kInfiniteSteps) continue;
+
+    costs_[node_index * stride_ + slot] = (u16)std::min(costs[node_index], (u32)(kUnreachable - 1));
+  }
+}
+
+}  // namespace path
+}  // namespace elm
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <elm/Types.h>
+#include <elm/path/NodeProcessor.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace elm {
+
+class ThreadPool;
+
+namespace path {
+
+// Landmark (ALT) heuristic tables.
+// The cheapest cost from each landmark to every node and from every node back to it is stored. By the triangle
+// inequality, the difference between the landmark costs of two nodes is a lower bound of the cost between them, and it
+// follows the walls and weights of the map instead of the straight line between them.
+// The costs are quantized to u16 and interleaved per node, so every landmark of a node is in one cache line. They are
+// calculated with every edge cost rounded down to a whole step, so the bound never drops by more than an edge's cost
+// across the edge. That keeps the bound consistent, so a search never has to open a node again.
+class Landmarks {
+ public:
+  static constexpr size_t kMaxLandmarks = 16;
+
+  Landmarks(const NodeProcessor& processor);
+
+  // Picks count landmarks that are far apart and calculates their cost tables from the processor's graph. The costs
+  // back to the landmarks and the stored tables are calculated on the pool, or on the calling thread without one.
+  void Build(size_t count, ThreadPool* pool = nullptr);
+
+  // The tables are only a valid bound for the graph they were built from, so they stop being used when it changes.
+  void Invalidate() { current_ = false; }
+  bool IsCurrent() const { return current_; }
+
+  size_t GetCount() const { return nodes_.size(); }
+  const std::vector<u32>& GetNodes() const { return nodes_; }
+
+  // A lower bound of the cost from the node to the goal.
+  inline float GetLowerBound(u32 index, u32 goal_index) const {
+    const u16* costs = costs_.data() + (size_t)index * stride_;
+    const u16* goal_costs = costs_.data() + (size_t)goal_index * stride_;
+    float best = 0.0f;
+
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      s32 from = costs[i * 2];
+      s32 to = costs[i * 2 + 1];
+      s32 goal_from = goal_costs[i * 2];
+      s32 goal_to = goal_costs[i * 2 + 1];
+
+      if (from != kUnreachable && goal_from != kUnreachable) {
+        best = std::max(best, (goal_from - from) * scales_[i * 2]);
+      }
+
+      if (to != kUnreachable && goal_to != kUnreachable) {
+        best = std::max(best, (to - goal_to) * scales_[i * 2 + 1]);
+      }
+    }
+
+    return best;
+  }
+
+ private:
+  static constexpr u16 kUnreachable = 0xFFFF;
+
+  // Calculates the cost from the node to every node, or the cost from every node to it for a reverse search.
+  void Search(u32 index, bool reverse, std::vector<float>& costs) const;
+  // Sets the scale of the landmark's forward or reverse costs so the largest of the real costs fits in a u16.
+  void SetScale(size_t landmark, bool reverse, const std::vector<float>& costs);
+  // Calculates and stores the landmark's forward or reverse costs in quantized steps of its scale.
+  void Store(size_t landmark, bool reverse);
+
+  const NodeProcessor& processor_;
+
+  std::vector<u32> nodes_;
+  // The cost per quantized step for each landmark's costs, in the same order as a node's costs.
+  std::vector<float> scales_;
+  // The cost from landmark i to the node is at node * stride + i * 2, and the cost back to it is after that.
+  std::vector<u16> costs_;
+  size_t stride_ = 0;
+  bool current_ = false;
+};
+
+}  // namespace path
+}  // namespace elm
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <elm/Hash.h>
+#include <elm/Types.h>
 
 #include <cstdint>
 
@@ -20,25 +21,36 @@ struct NodePoint {
 enum {
   NodeFlag_Openset = (1 << 0),
   NodeFlag_Closed = (1 << 1),
-  NodeFlag_Initialized = (1 << 2),
-  NodeFlag_Traversable = (1 << 3),
+  // Set while the node is in the openset queue. NodeFlag_Openset stays set after the node is popped.
+  NodeFlag_Queued = (1 << 2),
 };
 typedef u32 NodeFlags;
 
+// Node indices are below 1024 * 1024, so this is small enough to fit in Node::parent.
+constexpr u32 kInvalidNodeIndex = (1 << 21) - 1;
+
+// The search state is kept to 16 bytes so more nodes fit in a cache line.
+// The static node data, such as weight and traversability, is stored separately in the NavGraph.
 struct Node {
-  Node* parent;
-  u32 flags;
+  // Index of the parent node, or kInvalidNodeIndex if there is none.
+  u32 parent : 21;
+  u32 flags : 4;
+
+  // Position of this node in the openset heap. Only valid while the node is in the openset.
+  // The heap can't hold more than kMaxNodes, so 20 bits is enough.
+  u32 heap_index : 20;
+  // The search generation that last initialized this node. The search state is stale if it doesn't match the
+  // SearchContext's current generation.
+  u32 generation : 12;
 
   float g;
   float f;
-  // This is the fitness value of the node when it was last processed.
-  float f_last;
 
-  float weight;
-
-  Node() : flags(0), parent(nullptr), g(0.0f), f(0.0f), f_last(0.0f), weight(1.0f) {}
+  Node() : parent(kInvalidNodeIndex), flags(0), heap_index(0), generation(0), g(0.0f), f(0.0f) {}
 };
 
+static_assert(sizeof(Node) == 16, "Node should stay within 16 bytes.");
+
 }  // namespace path
 }  // namespace elm
 
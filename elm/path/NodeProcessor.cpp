@@ -1,5 +1,6 @@
 #include "NodeProcessor.h"
 
+#include <elm/OccupancyLayer.h>
 #include <elm/RayCaster.h>
 
 namespace elm {
@@ -7,19 +8,19 @@ namespace path {
 
 //
 
-EdgeSet NodeProcessor::FindEdges(Node* node, float radius) {
-  NodePoint point = GetPoint(node);
-  size_t index = (size_t)point.y * 1024 + point.x;
-  EdgeSet edges = this->edges_[index];
+EdgeSet NodeProcessor::FindEdges(u32 index, const Node* node, float radius) const {
+  NodePoint point = NavGraph::GetPoint(index);
+  EdgeSet edges = graph_->edges[index];
 
-  // Any extra checks can be done here to remove dynamic edges.
-  // if (west bad) edges.Erase(CoordOffset::WestIndex());
+  // Dynamic edges, such as ones blocked by temporary obstacles, are removed by the timed overload below.
 
 #if 1
-  if (node->parent) {
+  if (node->parent != kInvalidNodeIndex) {
     // Don't cycle back to parent. This saves a very small amount of time because that node would be ignored anyway.
-    NodePoint parent_point = GetPoint(node->parent);
-    CoordOffset offset(parent_point.x - point.x, parent_point.y - point.y);
+    // The parent isn't always next to the node when jump point search skips over nodes, so only the direction is used.
+    NodePoint parent_point = NavGraph::GetPoint(node->parent);
+    CoordOffset offset((parent_point.x > point.x) - (parent_point.x < point.x),
+                       (parent_point.y > point.y) - (parent_point.y < point.y));
 
     edges.Erase(offset.GetIndex());
   }
@@ -28,62 +29,36 @@ EdgeSet NodeProcessor::FindEdges(Node* node, float radius) {
   return edges;
 }
 
-inline bool CanOccupy(const Map& map, OccupiedRect& rect, Vector2f offset) {
-  Vector2f min = Vector2f(rect.start_x, rect.start_y) + offset;
-  Vector2f max = Vector2f(rect.end_x, rect.end_y) + offset;
+EdgeSet NodeProcessor::FindEdges(u32 index, const Node* node, float radius, const TemporaryObstacles& obstacles,
+                                 float time, float speed, EdgeSet* blocked) const {
+  EdgeSet edges = FindEdges(index, node, radius);
 
-  for (u16 y = (u16)min.y; y <= (u16)max.y; ++y) {
-    for (u16 x = (u16)min.x; x <= (u16)max.x; ++x) {
-      if (map.IsSolid(x, y)) {
-        return false;
-      }
-    }
-  }
+  *blocked = {};
 
-  return true;
-}
+  if (obstacles.Empty()) return edges;
 
-inline bool CanOccupyAxis(const Map& map, OccupiedRect& rect, Vector2f offset) {
-  Vector2f min = Vector2f(rect.start_x, rect.start_y) + offset;
-  Vector2f max = Vector2f(rect.end_x, rect.end_y) + offset;
+  NodePoint point = NavGraph::GetPoint(index);
 
-  if (offset.x < 0) {
-    // Moving west, so check western section of rect
-    for (u16 y = (u16)min.y; y <= (u16)max.y; ++y) {
-      if (map.IsSolid((u16)min.x, y)) {
-        return false;
-      }
-    }
-  } else if (offset.x > 0) {
-    // Moving east, so check eastern section of rect
-    for (u16 y = (u16)min.y; y <= (u16)max.y; ++y) {
-      if (map.IsSolid((u16)max.x, y)) {
-        return false;
-      }
-    }
-  } else if (offset.y < 0) {
-    // Moving north, so check north section of rect
-    for (u16 x = (u16)min.x; x <= (u16)max.x; ++x) {
-      if (map.IsSolid(x, (u16)min.y)) {
-        return false;
-      }
-    }
-  } else if (offset.y > 0) {
-    // Moving south, so check south section of rect
-    for (u16 x = (u16)min.x; x <= (u16)max.x; ++x) {
-      if (map.IsSolid(x, (u16)max.y)) {
-        return false;
-      }
+  for (size_t i = 0; i < 8; ++i) {
+    if (!edges.IsSet(i)) continue;
+
+    CoordOffset offset = CoordOffset::FromIndex(i);
+    NodePoint edge_point(point.x + offset.x, point.y + offset.y);
+
+    float arrival = time + CoordOffset::GetDistance(i) / speed;
+
+    if (obstacles.GetBlockedUntil(NavGraph::GetIndex(edge_point)) > arrival) {
+      edges.Erase(i);
+      blocked->Set(i);
     }
   }
 
-  return true;
+  return edges;
 }
 
-EdgeSet NodeProcessor::CalculateEdges(Node* node, float radius) {
+EdgeSet NodeProcessor::CalculateEdges(NodePoint base_point, const OccupancyLayer& layer) const {
   EdgeSet edges = {};
 
-  NodePoint base_point = GetPoint(node);
   MapCoord base(base_point.x, base_point.y);
 
   bool north = false;
@@ -96,7 +71,7 @@ EdgeSet NodeProcessor::CalculateEdges(Node* node, float radius) {
                                            CoordOffset::SouthWest(), CoordOffset::SouthEast()};
 
   OccupiedRect occupied[64];
-  size_t occupied_count = map_.GetAllOccupiedRects(Vector2f(base.x, base.y), radius, occupied);
+  size_t occupied_count = layer.GetAllOccupiedRects(base.x, base.y, occupied);
 
   for (std::size_t i = 0; i < 8; i++) {
     bool* requirement = requirements[i];
@@ -121,19 +96,15 @@ EdgeSet NodeProcessor::CalculateEdges(Node* node, float radius) {
 
     if (!is_occupied) {
       bool can_occupy = true;
-      Vector2f offset(neighbors[i].x, neighbors[i].y);
-      // Check each occupied rect to see if it can move in this direction
+      // Check each occupied rect to see if it can move in this direction.
+      // Every rect is already empty, so the moved rect only needs its box position checked in the layer.
       for (size_t j = 0; j < occupied_count; ++j) {
-        if (i >= 4) {
-          if (!CanOccupy(map_, occupied[j], offset)) {
-            can_occupy = false;
-            break;
-          }
-        } else {
-          if (!CanOccupyAxis(map_, occupied[j], offset)) {
-            can_occupy = false;
-            break;
-          }
+        s32 moved_x = occupied[j].start_x + neighbors[i].x;
+        s32 moved_y = occupied[j].start_y + neighbors[i].y;
+
+        if (!layer.CanFit(moved_x, moved_y)) {
+          can_occupy = false;
+          break;
         }
       }
 
@@ -142,15 +113,11 @@ EdgeSet NodeProcessor::CalculateEdges(Node* node, float radius) {
       }
     }
 
-    NodePoint current_point(world_x, world_y);
-    Node* current = GetNode(current_point);
+    if (world_x >= 1024 || world_y >= 1024) continue;
 
-    if (!current) continue;
-    if (!(current->flags & NodeFlag_Traversable)) continue;
+    u32 current_index = NavGraph::GetIndex(NodePoint(world_x, world_y));
 
-    if (map_.GetTileId(current_point.x, current_point.y) == kSafeTileId) {
-      current->weight = 10.0f;
-    }
+    if (!graph_->IsTraversable(current_index)) continue;
 
     edges.Set(i);
 
@@ -162,22 +129,5 @@ EdgeSet NodeProcessor::CalculateEdges(Node* node, float radius) {
   return edges;
 }
 
-Node* NodeProcessor::GetNode(NodePoint point) {
-  if (point.x >= 1024 || point.y >= 1024) {
-    return nullptr;
-  }
-
-  std::size_t index = point.y * 1024 + point.x;
-  Node* node = &nodes_[index];
-
-  if (!(node->flags & NodeFlag_Initialized)) {
-    node->g = node->f = node->f_last = 0.0f;
-    node->flags = NodeFlag_Initialized | (node->flags & NodeFlag_Traversable);
-    node->parent = nullptr;
-  }
-
-  return &nodes_[index];
-}
-
 }  // namespace path
 }  // namespace elm
@@ -2,7 +2,12 @@
 
 #include <elm/Map.h>
 #include <elm/path/Node.h>
+#include <elm/path/TemporaryObstacles.h>
 
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -11,6 +16,10 @@ namespace path {
 
 constexpr std::size_t kMaxNodes = 1024 * 1024;
 
+// The cost of a node that can't be reached.
+constexpr float kInfiniteCost = std::numeric_limits<float>::infinity();
+constexpr float kDiagonalDistance = 1.41421356f;
+
 struct EdgeSet {
   u8 set = 0;
 
@@ -56,11 +65,14 @@ struct CoordOffset {
     // Adjust x and y into positive space then combine them together to create a lookup index.
     s32 x_adj = x + 1;
     s32 y_adj = y + 1;
-    u32 combined = (y_adj << 2) | x_adj;
+    u32 combined = y_adj * 3 + x_adj;
 
     return kLookup[combined];
   }
 
+  // The length of the edge in the direction at the index. The diagonal directions come after the others.
+  static inline float GetDistance(size_t index) { return index < 4 ? 1.0f : kDiagonalDistance; }
+
   static inline size_t NorthIndex() { return 0; }
   static inline size_t SouthIndex() { return 1; }
   static inline size_t WestIndex() { return 2; }
@@ -71,43 +83,118 @@ struct CoordOffset {
   static inline size_t SouthEastIndex() { return 7; }
 };
 
-// Determines the node edges when using A*.
-class NodeProcessor {
- public:
-  NodeProcessor(const Map& map) : map_(map) {
-    nodes_.resize(kMaxNodes);
-    memset(&nodes_[0], 0, kMaxNodes * sizeof(Node));
+// Static navigation data created by Pathfinder::CreateMapWeights.
+// Nothing in here changes during a search, so one graph can be shared by any number of searches running at once.
+struct NavGraph {
+  std::vector<EdgeSet> edges;
+  // The cost multiplier for moving into each node.
+  std::vector<float> weights;
+  std::vector<u8> traversable;
 
-    edges_.resize(kMaxNodes);
-    memset(&edges_[0], 0, kMaxNodes * sizeof(EdgeSet));
-  }
+  NavGraph() : edges(kMaxNodes), weights(kMaxNodes, 1.0f), traversable(kMaxNodes, 0) {}
 
-  EdgeSet FindEdges(Node* node, float radius);
-  EdgeSet CalculateEdges(Node* node, float radius);
-  Node* GetNode(NodePoint point);
-  bool IsSolid(u16 x, u16 y) { return map_.IsSolid(x, y); }
+  inline bool IsTraversable(u32 index) const { return traversable[index] != 0; }
 
-  void SetEdgeSet(u16 x, u16 y, EdgeSet set) {
-    size_t index = (size_t)y * 1024 + x;
-    edges_[index] = set;
-  }
+  inline static u32 GetIndex(NodePoint point) { return (u32)point.y * 1024 + point.x; }
 
   // Calculate the node from the index.
   // This lets the node exist without storing its position so it fits in cache better.
-  inline NodePoint GetPoint(const Node* node) const {
-    size_t index = (node - &nodes_[0]);
-
+  inline static NodePoint GetPoint(u32 index) {
     uint16_t world_y = (uint16_t)(index / 1024);
     uint16_t world_x = (uint16_t)(index % 1024);
 
     return NodePoint(world_x, world_y);
   }
+};
+
+// Dijkstra over the edges of the graph from the source. A reverse search follows the edges that lead into each node, so
+// it finds the cost of reaching the source instead of the cost of leaving it. Either way, moving along an edge costs the
+// weight of the node that it leads into times the edge's length, which get_edge_cost turns into a Cost.
+// get_cost returns the cost stored for a node, and set_cost(index, cost, parent_index, direction) is called when the
+// search finds a lower one. The source's cost is set by the caller. Only the nodes in the bounds are searched, and the
+// search stops at the first node above max_cost.
+template <typename Cost, typename GetCost, typename SetCost, typename GetEdgeCost>
+void SearchGraph(const NavGraph& graph, u32 source, bool reverse, const MapRect& bounds, Cost max_cost,
+                 GetCost&& get_cost, SetCost&& set_cost, GetEdgeCost&& get_edge_cost) {
+  using Entry = std::pair<Cost, u32>;
+
+  std::vector<Entry> openset;
+
+  openset.push_back({Cost(), source});
+
+  while (!openset.empty()) {
+    std::pop_heap(openset.begin(), openset.end(), std::greater<Entry>());
+    Entry entry = openset.back();
+    openset.pop_back();
+
+    if (entry.first > max_cost) break;
+
+    u32 node_index = entry.second;
+
+    if (entry.first > get_cost(node_index)) continue;
+
+    NodePoint point = NavGraph::GetPoint(node_index);
+
+    for (size_t i = 0; i < 8; ++i) {
+      CoordOffset offset = CoordOffset::FromIndex(i);
+      s32 x = reverse ? point.x - offset.x : point.x + offset.x;
+      s32 y = reverse ? point.y - offset.y : point.y + offset.y;
+
+      if (!bounds.Contains(x, y)) continue;
+
+      u32 edge_index = NavGraph::GetIndex(NodePoint((u16)x, (u16)y));
+      u32 from_index = reverse ? edge_index : node_index;
+      u32 to_index = reverse ? node_index : edge_index;
+
+      if (!graph.edges[from_index].IsSet(i)) continue;
+
+      Cost cost = entry.first + get_edge_cost(graph.weights[to_index] * CoordOffset::GetDistance(i));
+
+      if (cost < get_cost(edge_index)) {
+        set_cost(edge_index, cost, node_index, i);
+
+        openset.push_back({cost, edge_index});
+        std::push_heap(openset.begin(), openset.end(), std::greater<Entry>());
+      }
+    }
+  }
+}
+
+// Determines the node edges when using A*.
+// The edges are stored in a NavGraph so the processor can be shared by searches that each have their own state.
+class NodeProcessor {
+ public:
+  NodeProcessor(const Map& map) : map_(map), graph_(std::make_shared<NavGraph>()) {}
+  NodeProcessor(const Map& map, std::shared_ptr<NavGraph> graph) : map_(map), graph_(std::move(graph)) {}
+
+  // Returns the edges that can be used to leave the node at the index during a search.
+  EdgeSet FindEdges(u32 index, const Node* node, float radius) const;
+  // Same as FindEdges, but also removes the edges into nodes that are still blocked by an obstacle when the ship would
+  // reach them after leaving at the time with the speed in tiles per second. The removed edges are set in blocked so
+  // the search can wait for them instead.
+  EdgeSet FindEdges(u32 index, const Node* node, float radius, const TemporaryObstacles& obstacles, float time,
+                    float speed, EdgeSet* blocked) const;
+  // Calculates the static edges for the node. This only reads the traversable flags from the graph, so it can run on
+  // multiple nodes at once.
+  EdgeSet CalculateEdges(NodePoint point, const OccupancyLayer& layer) const;
+  bool IsSolid(u16 x, u16 y) const { return map_.IsSolid(x, y); }
+
+  void SetEdgeSet(u16 x, u16 y, EdgeSet set) {
+    size_t index = (size_t)y * 1024 + x;
+    graph_->edges[index] = set;
+  }
+
+  inline bool IsTraversable(u32 index) const { return graph_->IsTraversable(index); }
+  inline float GetWeight(u32 index) const { return graph_->weights[index]; }
+
+  NavGraph& GetGraph() { return *graph_; }
+  const NavGraph& GetGraph() const { return *graph_; }
+  std::shared_ptr<NavGraph> GetSharedGraph() const { return graph_; }
 
   const Map& map_;
 
  private:
-  std::vector<EdgeSet> edges_;
-  std::vector<Node> nodes_;
+  std::shared_ptr<NavGraph> graph_;
 };
 
 }  // namespace path
@@ -1,11 +1,14 @@
 #include "Pathfinder.h"
 
+#include <elm/OccupancyLayer.h>
 #include <elm/RayCaster.h>
+#include <elm/path/IncrementalSearch.h>
 #include <immintrin.h>
 
 #include <algorithm>
 #include <bitset>
 #include <cmath>
+#include <limits>
 
 namespace elm {
 namespace path {
@@ -19,16 +22,6 @@ inline NodePoint ToNodePoint(const Vector2f v) {
   return np;
 }
 
-inline float Euclidean(NodeProcessor& processor, const Node* __restrict from, const Node* __restrict to) {
-  NodePoint from_p = processor.GetPoint(from);
-  NodePoint to_p = processor.GetPoint(to);
-
-  float dx = static_cast<float>(from_p.x - to_p.x);
-  float dy = static_cast<float>(from_p.y - to_p.y);
-
-  return sqrt(dx * dx + dy * dy);
-}
-
 inline float Euclidean(const NodePoint& __restrict from_p, const NodePoint& __restrict to_p) {
   float dx = static_cast<float>(from_p.x - to_p.x);
   float dy = static_cast<float>(from_p.y - to_p.y);
@@ -39,33 +32,379 @@ inline float Euclidean(const NodePoint& __restrict from_p, const NodePoint& __re
   return _mm_cvtss_f32(result);
 }
 
-Pathfinder::Pathfinder(std::unique_ptr<NodeProcessor> processor) : processor_(std::move(processor)) {}
+// The cost of the shortest path between the nodes on an open grid with a weight of one.
+inline float Octile(const NodePoint& __restrict from_p, const NodePoint& __restrict to_p) {
+  float dx = std::abs(static_cast<float>(from_p.x - to_p.x));
+  float dy = std::abs(static_cast<float>(from_p.y - to_p.y));
+
+  return std::max(dx, dy) + (kDiagonalDistance - 1.0f) * std::min(dx, dy);
+}
+
+void SearchContext::BeginSearch() {
+  if (++generation_ < kNodeGenerationCount) return;
+
+  // The generation wrapped around, so reset all of the nodes so old generations can't match a new search.
+  for (Node& node : nodes_) {
+    node.generation = 0;
+  }
+
+  generation_ = 1;
+}
+
+Node* SearchContext::GetNode(NodePoint point) {
+  if (point.x >= 1024 || point.y >= 1024) {
+    return nullptr;
+  }
+
+  std::size_t index = point.y * 1024 + point.x;
+  Node* node = &nodes_[index];
+
+  if (node->generation != generation_) {
+    node->g = node->f = 0.0f;
+    node->flags = 0;
+    node->parent = kInvalidNodeIndex;
+    node->generation = generation_;
+  }
+
+  return node;
+}
+
+Pathfinder::Pathfinder(std::unique_ptr<NodeProcessor> processor)
+    : processor_(std::move(processor)), context_(std::make_unique<SearchContext>()) {}
+
+Pathfinder::~Pathfinder() = default;
 
 std::vector<Vector2f> Pathfinder::FindPath(const Vector2f& from, const Vector2f& to, float ship_radius) {
+  return FindPath(*context_, from, to, ship_radius);
+}
+
+void Pathfinder::FindPaths(std::span<const PathQuery> queries, std::span<std::vector<Vector2f>> paths) {
+  if (paths.size() < queries.size()) {
+    queries = queries.first(paths.size());
+  }
+
+  if (queries.empty()) return;
+
+  // Don't bother creating or waking the workers for a single path.
+  bool single = queries.size() == 1;
+
+  if (!single && !thread_pool_) {
+    SetThreadCount(0);
+  }
+
+  if (single || thread_pool_->GetThreadCount() == 1) {
+    for (size_t i = 0; i < queries.size(); ++i) {
+      paths[i] = FindPath(*context_, queries[i].from, queries[i].to, queries[i].ship_radius);
+    }
+
+    return;
+  }
+
+  // The pool is shared with CreateMapWeights, and a batch can be smaller than the pool, so each worker only creates its
+  // search state once it runs a search.
+  worker_contexts_.resize(thread_pool_->GetThreadCount());
+
+  thread_pool_->Run(queries.size(), [this, queries, paths](size_t worker_index, size_t index) {
+    const PathQuery& query = queries[index];
+    std::unique_ptr<SearchContext>& context = worker_contexts_[worker_index];
+
+    if (!context) {
+      context = std::make_unique<SearchContext>();
+    }
+
+    paths[index] = FindPath(*context, query.from, query.to, query.ship_radius);
+  });
+}
+
+void Pathfinder::SetThreadCount(size_t thread_count) {
+  thread_pool_ = std::make_unique<ThreadPool>(thread_count);
+}
+
+ThreadPool* Pathfinder::GetThreadPool(size_t thread_count) {
+  if (thread_count == 1) return nullptr;
+
+  if (!thread_pool_) {
+    SetThreadCount(thread_count);
+  }
+
+  return thread_pool_.get();
+}
+
+std::vector<Vector2f> Pathfinder::FindPath(SearchContext& context, const Vector2f& from, const Vector2f& to_target,
+                                           float ship_radius) const {
+  Vector2f to = to_target;
+
+  if (!ResolveGoal(from, to, ship_radius)) return {};
+
+  if (cluster_graph_) {
+    NodePoint start_p = ToNodePoint(from);
+    NodePoint goal_p = ToNodePoint(to);
+
+    bool in_map = start_p.x < 1024 && start_p.y < 1024 && goal_p.x < 1024 && goal_p.y < 1024;
+
+    if (in_map && ClusterGraph::IsDistant(start_p, goal_p)) {
+      std::vector<Vector2f> path;
+
+      if (!processor_->IsTraversable(NavGraph::GetIndex(start_p))) return path;
+      if (!processor_->IsTraversable(NavGraph::GetIndex(goal_p))) return path;
+
+      std::vector<NodePoint> points;
+
+      // The entrances might miss a way through that only exists diagonally across a cluster corner, so fall back to
+      // the full search if the abstract one fails.
+      if (cluster_graph_->FindPath(start_p, goal_p, points)) {
+        path.reserve(points.size() + 1);
+        path.push_back(Vector2f(start_p.x + 0.5f, start_p.y + 0.5f));
+
+        for (NodePoint point : points) {
+          path.push_back(processor_->map_.GetOccupyCenter(Vector2f(point.x, point.y), ship_radius));
+        }
+
+        return path;
+      }
+    }
+  }
+
+  return Search<false>(context, from, to, ship_radius, nullptr, nullptr);
+}
+
+std::vector<Vector2f> Pathfinder::FindPath(const Vector2f& from, const Vector2f& to, float ship_radius,
+                                           const TimedSearch& timed, std::vector<float>* arrival_times) {
+  return FindPath(*context_, from, to, ship_radius, timed, arrival_times);
+}
+
+std::vector<Vector2f> Pathfinder::FindPath(SearchContext& context, const Vector2f& from, const Vector2f& to_target,
+                                           float ship_radius, const TimedSearch& timed,
+                                           std::vector<float>* arrival_times) const {
+  Vector2f to = to_target;
+
+  // Arrival times are distances divided by the speed, so a ship that can't move has no timed path.
+  if (timed.obstacles == nullptr || !(timed.speed > 0.0f) || !ResolveGoal(from, to, ship_radius)) {
+    if (arrival_times) arrival_times->clear();
+    return {};
+  }
+
+  return Search<true>(context, from, to, ship_radius, &timed, arrival_times);
+}
+
+std::vector<Vector2f> Pathfinder::FindPathIncremental(const Vector2f& from, const Vector2f& to_target,
+                                                      float ship_radius) {
+  Vector2f to = to_target;
+
+  if (!ResolveGoal(from, to, ship_radius)) return {};
+
+  if (!incremental_search_) {
+    incremental_search_ = std::make_unique<IncrementalSearch>(*processor_);
+  }
+
+  return incremental_search_->FindPath(ToNodePoint(from), ToNodePoint(to), ship_radius);
+}
+
+std::vector<Vector2f> Pathfinder::FindPath(const FlowField& field, const Vector2f& from, float ship_radius) const {
   std::vector<Vector2f> path;
+  NodePoint point = ToNodePoint(from);
+  NodePoint next;
+
+  if (!field.GetNextPoint(point, &next)) return path;
+
+  path.push_back(Vector2f(point.x + 0.5f, point.y + 0.5f));
+
+  // Every step costs more than zero, so following the directions always ends at the goal.
+  do {
+    point = next;
+    path.push_back(processor_->map_.GetOccupyCenter(Vector2f(point.x, point.y), ship_radius));
+  } while (field.GetNextPoint(point, &next));
+
+  return path;
+}
+
+bool Pathfinder::ResolveGoal(const Vector2f& from, Vector2f& to, float ship_radius) const {
+  if (!region_registry_ || region_registry_->radius_ != ship_radius) return true;
+
+  MapCoord start(from);
+  MapCoord goal(to);
+
+  // The search rejects positions outside of the map itself.
+  if (!IsValidPosition(start) || !IsValidPosition(goal)) return true;
+
+  RegionIndex region = region_registry_->coord_regions_[start.y * 1024 + start.x];
+
+  // Nothing is known about a start that isn't in a region, so let the search decide.
+  if (region == kUndefinedRegion) return true;
+  if (region_registry_->coord_regions_[goal.y * 1024 + goal.x] == region) return true;
+  if (!snap_goals_) return false;
+
+  // The goal can't be reached, so find the closest node in the start's region instead. Every tile in a ring is at
+  // least the ring's size away, so the rings can stop once that is further than the best node.
+  s32 best_distance_sq = std::numeric_limits<s32>::max();
+  MapCoord best(0, 0);
+
+  auto check = [&](s32 x, s32 y) {
+    if (x < 0 || x >= 1024) return;
+
+    u32 index = (u32)y * 1024 + x;
 
-  Node* start = processor_->GetNode(ToNodePoint(from));
-  Node* goal = processor_->GetNode(ToNodePoint(to));
+    if (region_registry_->coord_regions_[index] != region || !processor_->IsTraversable(index)) return;
+
+    s32 dx = x - goal.x;
+    s32 dy = y - goal.y;
+    s32 distance_sq = dx * dx + dy * dy;
+
+    if (distance_sq < best_distance_sq) {
+      best_distance_sq = distance_sq;
+      best = MapCoord((u16)x, (u16)y);
+    }
+  };
+
+  for (s32 ring = 1; ring < 1024 && ring * ring < best_distance_sq; ++ring) {
+    for (s32 y = goal.y - ring; y <= goal.y + ring; ++y) {
+      if (y < 0 || y >= 1024) continue;
+
+      if (y == goal.y - ring || y == goal.y + ring) {
+        for (s32 x = goal.x - ring; x <= goal.x + ring; ++x) {
+          check(x, y);
+        }
+      } else {
+        check(goal.x - ring, y);
+        check(goal.x + ring, y);
+      }
+    }
+  }
+
+  if (best_distance_sq == std::numeric_limits<s32>::max()) return false;
+
+  to = Vector2f(best.x + 0.5f, best.y + 0.5f);
+  return true;
+}
+
+template <bool kTimed>
+std::vector<Vector2f> Pathfinder::Search(SearchContext& context, const Vector2f& from, const Vector2f& to,
+                                         float ship_radius, const TimedSearch* timed,
+                                         std::vector<float>* arrival_times) const {
+  // Temporary obstacles can block jump nodes, so timed searches always expand every node.
+  constexpr bool kCanJump = !kTimed;
+  bool jump_point = kCanJump && jump_point_search_;
+
+  if (open_set_type_ == OpenSetType::Buckets) {
+    context.bucket_openset_.SetBucketWidth(bucket_width_);
+
+    if (jump_point) {
+      return Search<kTimed, kCanJump>(context, context.bucket_openset_, from, to, ship_radius, timed, arrival_times);
+    }
+
+    return Search<kTimed, false>(context, context.bucket_openset_, from, to, ship_radius, timed, arrival_times);
+  }
+
+  if (jump_point) {
+    return Search<kTimed, kCanJump>(context, context.openset_, from, to, ship_radius, timed, arrival_times);
+  }
+
+  return Search<kTimed, false>(context, context.openset_, from, to, ship_radius, timed, arrival_times);
+}
+
+template <bool kTimed, bool kJumpPoint, typename OpenSet>
+std::vector<Vector2f> Pathfinder::Search(SearchContext& context, OpenSet& openset, const Vector2f& from,
+                                         const Vector2f& to, float ship_radius, const TimedSearch* timed,
+                                         std::vector<float>* arrival_times) const {
+  std::vector<Vector2f> path;
+
+  if (arrival_times) arrival_times->clear();
+
+  context.BeginSearch();
+
+  Node* start = context.GetNode(ToNodePoint(from));
+  Node* goal = context.GetNode(ToNodePoint(to));
 
   if (start == nullptr || goal == nullptr) {
     return path;
   }
 
-  if (!(start->flags & NodeFlag_Traversable)) return path;
-  if (!(goal->flags & NodeFlag_Traversable)) return path;
+  if (!processor_->IsTraversable(context.GetIndex(start))) return path;
+  if (!processor_->IsTraversable(context.GetIndex(goal))) return path;
 
-  NodePoint start_p = processor_->GetPoint(start);
-  NodePoint goal_p = processor_->GetPoint(goal);
+  NodePoint start_p = context.GetPoint(start);
+  NodePoint goal_p = context.GetPoint(goal);
+
+  u32 goal_index = context.GetIndex(goal);
+  const Landmarks* landmarks = landmarks_ && landmarks_->IsCurrent() ? landmarks_.get() : nullptr;
+
+  // Only timed searches track when the ship reaches each node.
+  float* times = kTimed ? context.GetArrivalTimes().data() : nullptr;
+
+  if constexpr (kTimed) {
+    // A ship that starts inside a temporary obstacle waits there until it expires before leaving.
+    u32 start_index = context.GetIndex(start);
+
+    times[start_index] = std::max(timed->start_time, timed->obstacles->GetBlockedUntil(start_index));
+  }
+
+  // Adds the neighbor to the open set if the cost through the current node is better than what it had.
+  auto open_edge = [&](u32 node_index, NodePoint edge_point, float cost, float arrival) {
+    Node* edge = context.GetNode(edge_point);
+
+    // The node's f can't improve when its cost doesn't, since its heuristic is always the same. This also skips looking
+    // up the landmark costs, which is slow.
+    if ((edge->flags & NodeFlag_Openset) && cost >= edge->g) return;
+
+    // Compute a heuristic from this neighbor to the end goal.
+    // Jump point search uses the octile distance because it's exact across open areas, so far fewer nodes are opened.
+    float h = kJumpPoint ? Octile(edge_point, goal_p) : Euclidean(edge_point, goal_p);
+
+    // The landmark bound is also never above the real cost, so the larger bound is used.
+    if (landmarks) {
+      h = std::max(h, landmarks->GetLowerBound(NavGraph::GetIndex(edge_point), goal_index));
+    }
+
+    // If this neighbor hasn't been considered or is better than its original fitness test, then add it back to the
+    // open set.
+    if (!(edge->flags & NodeFlag_Openset) || cost + h < edge->f) {
+      edge->g = cost;
+      edge->f = edge->g + h;
+      edge->parent = node_index;
+      // A closed node that was reached with a lower cost is opened again.
+      edge->flags = (edge->flags & ~NodeFlag_Closed) | NodeFlag_Openset;
+
+      if constexpr (kTimed) {
+        times[NavGraph::GetIndex(edge_point)] = arrival;
+      }
+
+      // A node that was popped isn't in the queue anymore, so reopening it pushes it again.
+      if (edge->flags & NodeFlag_Queued) {
+        openset.Decrease(edge);
+      } else {
+        edge->flags |= NodeFlag_Queued;
+        openset.Push(edge);
+      }
+    }
+  };
+
+  // Opens the first node in the direction that isn't a jump node, or the goal if it's reached first.
+  // Every node crossed is a jump node, so each step costs one.
+  auto open_jump = [&](Node* node, u32 node_index, NodePoint node_point, size_t direction) {
+    CoordOffset offset = CoordOffset::FromIndex(direction);
+    s32 steps = jump_distances_[direction][node_index];
+    s32 goal_steps = offset.x != 0 ? (goal_p.x - node_point.x) * offset.x : (goal_p.y - node_point.y) * offset.y;
+    bool goal_on_line = offset.x != 0 ? goal_p.y == node_point.y : goal_p.x == node_point.x;
+
+    if (goal_on_line && goal_steps > 0 && goal_steps < steps) {
+      steps = goal_steps;
+    }
+
+    NodePoint jump_point(node_point.x + offset.x * steps, node_point.y + offset.y * steps);
+
+    open_edge(node_index, jump_point, node->g + (float)steps, 0.0f);
+  };
 
   // clear vector then add start node
-  openset_.Clear();
-  openset_.Push(start);
+  openset.Clear();
+  openset.Push(start);
+  start->flags |= NodeFlag_Openset | NodeFlag_Queued;
 
   // at the start there is only one node here, the start node
-  while (!openset_.Empty()) {
-    Node* node = openset_.Pop();
+  while (!openset.Empty()) {
+    Node* node = openset.Pop();
 
-    touched_.push_back(node);
+    node->flags &= ~NodeFlag_Queued;
 
     if (node == goal) {
       break;
@@ -73,17 +412,57 @@ std::vector<Vector2f> Pathfinder::FindPath(const Vector2f& from, const Vector2f&
 
     node->flags |= NodeFlag_Closed;
 
-    if (node->f > 0 && node->f == node->f_last) {
-      // This node was re-added to the openset because its fitness was better, so skip reprocessing the same node.
-      // This reduces pathing time by about 20%.
-      continue;
-    }
-    node->f_last = node->f;
+    u32 node_index = context.GetIndex(node);
+    NodePoint node_point = NavGraph::GetPoint(node_index);
+
+    if constexpr (kJumpPoint) {
+      if (IsJumpNode(node_index)) {
+        s16 dx = 0;
+        s16 dy = 0;
+        bool pruned = false;
+
+        // Every neighbor of a jump node is a node with a weight of one and every edge, so the neighbors that aren't
+        // ahead of the direction of travel are reached at least as cheaply without going through this node.
+        if (node->parent != kInvalidNodeIndex) {
+          NodePoint parent_point = NavGraph::GetPoint(node->parent);
+
+          dx = (node_point.x > parent_point.x) - (node_point.x < parent_point.x);
+          dy = (node_point.y > parent_point.y) - (node_point.y < parent_point.y);
+          pruned = true;
+        }
+
+        for (size_t i = 0; i < 8; ++i) {
+          CoordOffset offset = CoordOffset::FromIndex(i);
 
-    NodePoint node_point = processor_->GetPoint(node);
+          // Keep going in the same direction, or along either axis of a diagonal direction.
+          if (pruned && !((offset.x == dx || offset.x == 0) && (offset.y == dy || offset.y == 0))) continue;
+
+          if (offset.x != 0 && offset.y != 0) {
+            NodePoint edge_point(node_point.x + offset.x, node_point.y + offset.y);
+            float cost = node->g + processor_->GetWeight(NavGraph::GetIndex(edge_point)) * CoordOffset::GetDistance(i);
+
+            open_edge(node_index, edge_point, cost, 0.0f);
+          } else {
+            open_jump(node, node_index, node_point, i);
+          }
+        }
+
+        continue;
+      }
+    }
 
     // returns neighbor nodes that are not solid
-    EdgeSet edges = processor_->FindEdges(node, ship_radius);
+    EdgeSet edges;
+    // Edges into nodes that are still blocked by a temporary obstacle when the ship would get there.
+    EdgeSet blocked;
+
+    if constexpr (kTimed) {
+      edges = processor_->FindEdges(node_index, node, ship_radius, *timed->obstacles, times[node_index], timed->speed,
+                                    &blocked);
+      edges.set |= blocked.set;
+    } else {
+      edges = processor_->FindEdges(node_index, node, ship_radius);
+    }
 
     for (size_t i = 0; i < 8; ++i) {
       if (!edges.IsSet(i)) continue;
@@ -91,32 +470,30 @@ std::vector<Vector2f> Pathfinder::FindPath(const Vector2f& from, const Vector2f&
       CoordOffset offset = CoordOffset::FromIndex(i);
 
       NodePoint edge_point(node_point.x + offset.x, node_point.y + offset.y);
-      Node* edge = processor_->GetNode(edge_point);
-
-      touched_.push_back(edge);
+      u32 edge_index = NavGraph::GetIndex(edge_point);
+      float distance = CoordOffset::GetDistance(i);
 
       // The cost to this neighbor is the cost to the current node plus the edge weight times the distance between the
       // nodes.
-      float cost = node->g + edge->weight * Euclidean(node_point, edge_point);
+      float cost = node->g + processor_->GetWeight(edge_index) * distance;
+      float arrival = 0.0f;
 
-      // If the new cost is lower than the previously closed cost then remove it from the closed set.
-      if ((edge->flags & NodeFlag_Closed) && cost < edge->g) {
-        edge->flags &= ~NodeFlag_Closed;
-      }
+      if constexpr (kTimed) {
+        float leave_time = times[node_index];
 
-      // Compute a heuristic from this neighbor to the end goal.
-      float h = Euclidean(edge_point, goal_p);
+        // Obstacles only expire, so the current node stays open while the ship waits in it for the blocked node.
+        if (blocked.IsSet(i)) {
+          float open_time = timed->obstacles->GetBlockedUntil(edge_index);
+          float wait_leave_time = open_time - distance / timed->speed;
 
-      // If this neighbor hasn't been considered or is better than its original fitness test, then add it back to the
-      // open set.
-      if (!(edge->flags & NodeFlag_Openset) || cost + h < edge->f) {
-        edge->g = cost;
-        edge->f = edge->g + h;
-        edge->parent = node;
-        edge->flags |= NodeFlag_Openset;
+          cost += (wait_leave_time - leave_time) * timed->speed;
+          leave_time = wait_leave_time;
+        }
 
-        openset_.Push(edge);
+        arrival = leave_time + distance / timed->speed;
       }
+
+      open_edge(node_index, edge_point, cost, arrival);
     }
   }
 
@@ -125,15 +502,36 @@ std::vector<Vector2f> Pathfinder::FindPath(const Vector2f& from, const Vector2f&
   Node* current = goal;
 
   while (current != nullptr && current != start) {
-    NodePoint p = processor_->GetPoint(current);
+    NodePoint p = context.GetPoint(current);
     points.push_back(p);
-    current = current->parent;
+
+    Node* parent = context.GetParent(current);
+
+    if constexpr (kJumpPoint) {
+      // Jumps skip over the nodes between them, so fill those back in.
+      if (parent != nullptr) {
+        NodePoint parent_point = context.GetPoint(parent);
+        s16 dx = (parent_point.x > p.x) - (parent_point.x < p.x);
+        s16 dy = (parent_point.y > p.y) - (parent_point.y < p.y);
+
+        for (p = NodePoint(p.x + dx, p.y + dy); !(p == parent_point); p = NodePoint(p.x + dx, p.y + dy)) {
+          points.push_back(p);
+        }
+      }
+    }
+
+    current = parent;
   }
 
   path.reserve(points.size() + 1);
 
-  if (goal->parent) {
+  if (goal->parent != kInvalidNodeIndex) {
     path.push_back(Vector2f(start_p.x + 0.5f, start_p.y + 0.5f));
+
+    if (kTimed && arrival_times) {
+      arrival_times->reserve(points.size() + 1);
+      arrival_times->push_back(timed->start_time);
+    }
   }
 
   // Reverse and store as vector
@@ -144,92 +542,354 @@ std::vector<Vector2f> Pathfinder::FindPath(const Vector2f& from, const Vector2f&
     pos = processor_->map_.GetOccupyCenter(pos, ship_radius);
 
     path.push_back(pos);
-  }
 
-  for (Node* node : touched_) {
-    node->flags &= ~NodeFlag_Initialized;
+    if (kTimed && arrival_times) {
+      arrival_times->push_back(times[NavGraph::GetIndex(points[index])]);
+    }
   }
 
-  touched_.clear();
-
   return path;
 }
 
-float GetWallDistance(const Map& map, u16 x, u16 y, u16 radius) {
-  float closest_sq = std::numeric_limits<float>::max();
-
-  for (i16 offset_y = -radius; offset_y < radius; ++offset_y) {
-    for (i16 offset_x = -radius; offset_x < radius; ++offset_x) {
-      u16 check_x = x + offset_x;
-      u16 check_y = y + offset_y;
+// Number of rows in each job when building the map weights on multiple threads.
+constexpr u16 kWeightBandRows = 16;
+constexpr size_t kWeightBandCount = 1024 / kWeightBandRows;
 
-      if (map.IsSolid(check_x, check_y)) {
-        float dist_sq = (float)(offset_x * offset_x + offset_y * offset_y);
+// Tiles closer than this to a wall are weighted higher when using linear weights.
+constexpr int kCloseWallDistance = 5;
 
-        if (dist_sq < closest_sq) {
-          closest_sq = dist_sq;
-        }
-      }
-    }
-  }
+// Calculates which nodes are traversable. Diagonal-only tiles are appended to diagonals in row order.
+static void BuildTraversable(const Map& map, const OccupancyLayer& layer, NavGraph& graph, const MapRect& rect,
+                             std::vector<Vector2f>& diagonals) {
+  OccupiedRect scratch_rects[256];
 
-  return std::sqrt(closest_sq);
-}
+  for (s32 y = rect.start_y; y <= rect.end_y; ++y) {
+    for (s32 x = rect.start_x; x <= rect.end_x; ++x) {
+      u32 index = NavGraph::GetIndex(NodePoint(x, y));
 
-void Pathfinder::CreateMapWeights(const Map& map, float ship_radius, bool linear_weights) {
-  OccupiedRect* scratch_rects = new OccupiedRect[256];
+      graph.traversable[index] = 0;
 
-  // Calculate which nodes are traversable before creating edges.
-  for (u16 y = 0; y < 1024; ++y) {
-    for (u16 x = 0; x < 1024; ++x) {
       if (map.IsSolid(x, y)) continue;
 
-      Node* node = processor_->GetNode(NodePoint(x, y));
-
-      if (map.CanOverlapTile(Vector2f(x, y), ship_radius)) {
-        node->flags |= NodeFlag_Traversable;
+      if (layer.CanOverlapTile(x, y)) {
+        graph.traversable[index] = 1;
 
-        size_t rect_count = map.GetAllOccupiedRects(Vector2f(x, y), ship_radius, scratch_rects);
+        size_t rect_count = layer.GetAllOccupiedRects(x, y, scratch_rects);
 
         // This might be a diagonal tile
         if (rect_count == 2) {
           // Check if the two occupied rects are offset on both axes.
-          if (scratch_rects[0].start_x != scratch_rects[1].start_x && scratch_rects[0].start_y != scratch_rects[1].start_y) {
+          if (scratch_rects[0].start_x != scratch_rects[1].start_x &&
+              scratch_rects[0].start_y != scratch_rects[1].start_y) {
             // This is a diagonal-only tile, so skip it.
-            debug_diagonals_.push_back(Vector2f(x, y));
+            diagonals.push_back(Vector2f(x, y));
 
-            node->flags &= ~NodeFlag_Traversable;
+            graph.traversable[index] = 0;
           }
         }
       }
     }
   }
+}
 
-  delete[] scratch_rects;
+// Calculates the edges and the wall weight of each node. The traversable flags must already be built around the rect.
+static void BuildEdges(const Map& map, const OccupancyLayer& layer, NodeProcessor& processor, const MapRect& rect,
+                       bool linear_weights) {
+  NavGraph& graph = processor.GetGraph();
 
-  for (u16 y = 0; y < 1024; ++y) {
-    for (u16 x = 0; x < 1024; ++x) {
-      if (map.IsSolid(x, y)) continue;
-      Node* node = processor_->GetNode(NodePoint(x, y));
-      EdgeSet edges = processor_->CalculateEdges(node, ship_radius);
+  for (s32 y = rect.start_y; y <= rect.end_y; ++y) {
+    for (s32 x = rect.start_x; x <= rect.end_x; ++x) {
+      u32 index = NavGraph::GetIndex(NodePoint(x, y));
 
-      processor_->SetEdgeSet(x, y, edges);
+      if (map.IsSolid(x, y)) {
+        // Solid nodes are never searched, so give them the same data as a graph that was never built.
+        graph.edges[index] = EdgeSet();
+        graph.weights[index] = 1.0f;
+        continue;
+      }
 
-      node->weight = 1.0f;
+      EdgeSet edges = processor.CalculateEdges(NodePoint(x, y), layer);
+
+      processor.SetEdgeSet(x, y, edges);
+
+      graph.weights[index] = 1.0f;
 
       if (linear_weights) {
-        int close_distance = 5;
-        float distance = GetWallDistance(map, x, y, close_distance);
+        float distance = map.GetWallDistance(x, y);
 
         if (distance < 1) distance = 1;
 
-        if (distance < close_distance) {
-          node->weight = close_distance / distance;
+        if (distance < kCloseWallDistance) {
+          graph.weights[index] = kCloseWallDistance / distance;
         }
       }
     }
   }
 }
 
+// Safe tiles are weighted by the edges that lead into them from the neighbors that come after them in row order.
+// This is done after every edge exists so the result doesn't depend on the order that the edges were built in.
+static void BuildSafeWeights(const Map& map, NavGraph& graph, const MapRect& rect) {
+  for (s32 y = rect.start_y; y <= rect.end_y; ++y) {
+    for (s32 x = rect.start_x; x <= rect.end_x; ++x) {
+      if (map.GetTileId(x, y) != kSafeTileId) continue;
+
+      u32 index = NavGraph::GetIndex(NodePoint(x, y));
+
+      if (!graph.IsTraversable(index)) continue;
+
+      bool entered = x < 1023 && graph.edges[index + 1].IsSet(CoordOffset::WestIndex());
+
+      if (y < 1023) {
+        u32 below = index + 1024;
+
+        entered = entered || (x > 0 && graph.edges[below - 1].IsSet(CoordOffset::NorthEastIndex()));
+        entered = entered || graph.edges[below].IsSet(CoordOffset::NorthIndex());
+        entered = entered || (x < 1023 && graph.edges[below + 1].IsSet(CoordOffset::NorthWestIndex()));
+      }
+
+      if (entered) {
+        graph.weights[index] = 10.0f;
+      }
+    }
+  }
+}
+
+void Pathfinder::CreateMapWeights(const Map& map, float ship_radius, bool linear_weights, size_t thread_count) {
+  const OccupancyLayer& layer = map.GetOccupancyLayer(ship_radius);
+  NavGraph& graph = processor_->GetGraph();
+
+  ship_radius_ = ship_radius;
+  linear_weights_ = linear_weights;
+
+  ThreadPool* pool = GetThreadPool(thread_count);
+
+  // Runs the band function over every band of rows. Each band only writes the data for its own rows.
+  auto for_each_band = [pool](const std::function<void(size_t band, const MapRect& rect)>& func) {
+    auto job = [&func](size_t, size_t band) {
+      s32 begin_y = (s32)(band * kWeightBandRows);
+      func(band, MapRect(0, begin_y, 1023, begin_y + kWeightBandRows - 1));
+    };
+
+    if (pool) {
+      pool->Run(kWeightBandCount, job);
+    } else {
+      for (size_t band = 0; band < kWeightBandCount; ++band) {
+        job(0, band);
+      }
+    }
+  };
+
+  // Diagonal tiles are gathered per band and merged in band order so the list is in row order on any thread count.
+  std::vector<std::vector<Vector2f>> band_diagonals(kWeightBandCount);
+
+  for_each_band([&](size_t band, const MapRect& rect) {
+    BuildTraversable(map, layer, graph, rect, band_diagonals[band]);
+  });
+
+  for (auto& diagonals : band_diagonals) {
+    debug_diagonals_.insert(debug_diagonals_.end(), diagonals.begin(), diagonals.end());
+  }
+
+  for_each_band([&](size_t, const MapRect& rect) { BuildEdges(map, layer, *processor_, rect, linear_weights); });
+  for_each_band([&](size_t, const MapRect& rect) { BuildSafeWeights(map, graph, rect); });
+
+  if (jump_point_search_) {
+    BuildJumpDistances(MapRect(0, 0, 1023, 1023));
+  }
+
+  if (cluster_graph_) {
+    cluster_graph_->Build();
+  }
+
+  if (landmarks_) {
+    landmarks_->Build(landmarks_->GetCount(), pool);
+  }
+
+  if (incremental_search_) {
+    incremental_search_->Reset();
+  }
+}
+
+void Pathfinder::UpdateMapWeights(const Map& map, std::span<const MapRect> changed) {
+  if (changed.empty()) return;
+
+  const OccupancyLayer& layer = map.GetOccupancyLayer(ship_radius_);
+  NavGraph& graph = processor_->GetGraph();
+
+  // The traversable flag of a node depends on the occupancy bits around it. The edges also depend on the traversable
+  // flags of the neighbors, and the safe weights depend on the edges of the neighbors.
+  s32 traversable_margin = layer.GetInfluence();
+  s32 weight_margin = std::max(traversable_margin + 2, kCloseWallDistance);
+
+  std::vector<Vector2f> diagonals;
+
+  for (const MapRect& rect : changed) {
+    MapRect traversable_rect = rect.Expand(traversable_margin);
+
+    std::erase_if(debug_diagonals_, [&traversable_rect](const Vector2f& diagonal) {
+      return traversable_rect.Contains((s32)diagonal.x, (s32)diagonal.y);
+    });
+
+    BuildTraversable(map, layer, graph, traversable_rect, diagonals);
+  }
+
+  for (const MapRect& rect : changed) {
+    BuildEdges(map, layer, *processor_, rect.Expand(weight_margin), linear_weights_);
+  }
+
+  for (const MapRect& rect : changed) {
+    BuildSafeWeights(map, graph, rect.Expand(weight_margin));
+  }
+
+  if (jump_point_search_) {
+    // A node stops being a jump node when any node around it changes.
+    for (const MapRect& rect : changed) {
+      BuildJumpDistances(rect.Expand(weight_margin + 1));
+    }
+  }
+
+  if (cluster_graph_) {
+    for (const MapRect& rect : changed) {
+      cluster_graph_->Update(rect.Expand(weight_margin));
+    }
+  }
+
+  if (landmarks_) {
+    landmarks_->Invalidate();
+  }
+
+  if (incremental_search_) {
+    for (const MapRect& rect : changed) {
+      incremental_search_->UpdateEdges(rect.Expand(weight_margin));
+    }
+  }
+
+  // Overlapping rects can find the same diagonal more than once.
+  debug_diagonals_.insert(debug_diagonals_.end(), diagonals.begin(), diagonals.end());
+
+  std::sort(debug_diagonals_.begin(), debug_diagonals_.end(), [](const Vector2f& lhs, const Vector2f& rhs) {
+    return lhs.y != rhs.y ? lhs.y < rhs.y : lhs.x < rhs.x;
+  });
+
+  debug_diagonals_.erase(std::unique(debug_diagonals_.begin(), debug_diagonals_.end(),
+                                     [](const Vector2f& lhs, const Vector2f& rhs) {
+                                       return lhs.x == rhs.x && lhs.y == rhs.y;
+                                     }),
+                         debug_diagonals_.end());
+}
+
+void Pathfinder::SetJumpPointSearch(bool enabled) {
+  jump_point_search_ = enabled;
+
+  if (enabled) {
+    BuildJumpDistances(MapRect(0, 0, 1023, 1023));
+  } else {
+    for (auto& distances : jump_distances_) {
+      distances = std::vector<u16>();
+    }
+  }
+}
+
+void Pathfinder::SetHierarchicalSearch(bool enabled) {
+  if (!enabled) {
+    cluster_graph_ = nullptr;
+    return;
+  }
+
+  cluster_graph_ = std::make_unique<ClusterGraph>(*processor_);
+  cluster_graph_->Build();
+}
+
+void Pathfinder::SetLandmarks(size_t count, size_t thread_count) {
+  if (count == 0) {
+    landmarks_ = nullptr;
+    return;
+  }
+
+  if (!landmarks_) {
+    landmarks_ = std::make_unique<Landmarks>(*processor_);
+  }
+
+  landmark_thread_count_ = thread_count;
+  landmarks_->Build(count, GetThreadPool(thread_count));
+}
+
+void Pathfinder::UpdateLandmarks() {
+  if (landmarks_ && !landmarks_->IsCurrent()) {
+    landmarks_->Build(landmarks_->GetCount(), GetThreadPool(landmark_thread_count_));
+  }
+}
+
+void Pathfinder::BuildJumpDistances(const MapRect& rect) {
+  const NavGraph& graph = processor_->GetGraph();
+
+  for (auto& distances : jump_distances_) {
+    if (distances.empty()) distances.resize(kMaxNodes, 0);
+  }
+
+  auto is_uniform = [&graph](s32 x, s32 y) {
+    if (x < 0 || y < 0 || x >= 1024 || y >= 1024) return false;
+
+    u32 index = NavGraph::GetIndex(NodePoint(x, y));
+
+    return graph.IsTraversable(index) && graph.weights[index] == 1.0f && graph.edges[index].set == 0xFF;
+  };
+
+  auto is_jump_node = [&is_uniform](s32 x, s32 y) {
+    for (s32 dy = -1; dy <= 1; ++dy) {
+      for (s32 dx = -1; dx <= 1; ++dx) {
+        if (!is_uniform(x + dx, y + dy)) return false;
+      }
+    }
+
+    return true;
+  };
+
+  // Border nodes are missing the edges that leave the map, so every line starts and ends with a node that isn't a jump
+  // node. Each line is scanned both ways, counting the steps since the last node that wasn't one.
+  bool line[1024];
+
+  for (s32 y = rect.start_y; y <= rect.end_y; ++y) {
+    for (s32 x = 0; x < 1024; ++x) {
+      line[x] = is_jump_node(x, y);
+    }
+
+    u16 steps = 0;
+
+    for (s32 x = 0; x < 1024; ++x) {
+      steps = line[x] ? steps + 1 : 0;
+      jump_distances_[CoordOffset::WestIndex()][y * 1024 + x] = steps;
+    }
+
+    steps = 0;
+
+    for (s32 x = 1023; x >= 0; --x) {
+      steps = line[x] ? steps + 1 : 0;
+      jump_distances_[CoordOffset::EastIndex()][y * 1024 + x] = steps;
+    }
+  }
+
+  for (s32 x = rect.start_x; x <= rect.end_x; ++x) {
+    for (s32 y = 0; y < 1024; ++y) {
+      line[y] = is_jump_node(x, y);
+    }
+
+    u16 steps = 0;
+
+    for (s32 y = 0; y < 1024; ++y) {
+      steps = line[y] ? steps + 1 : 0;
+      jump_distances_[CoordOffset::NorthIndex()][y * 1024 + x] = steps;
+    }
+
+    steps = 0;
+
+    for (s32 y = 1023; y >= 0; --y) {
+      steps = line[y] ? steps + 1 : 0;
+      jump_distances_[CoordOffset::SouthIndex()][y * 1024 + x] = steps;
+    }
+  }
+}
+
 }  // namespace path
 }  // namespace elm
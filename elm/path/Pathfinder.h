@@ -2,10 +2,15 @@
 
 #include <elm/Map.h>
 #include <elm/Math.h>
+#include <elm/ThreadPool.h>
+#include <elm/path/ClusterGraph.h>
+#include <elm/path/FlowField.h>
+#include <elm/path/Landmarks.h>
 #include <elm/path/NodeProcessor.h>
 
 #include <algorithm>
 #include <memory>
+#include <span>
 #include <unordered_set>
 #include <vector>
 
@@ -43,21 +48,415 @@ class PriorityQueue {
   Compare comparator_;
 };
 
-struct Pathfinder {
+// Binary heap that tracks the position of each item so an item can have its priority improved in place.
+// IndexOf must provide Get(item) and Set(item, index) for the heap index storage of an item.
+template <typename T, typename Compare, typename IndexOf>
+class IndexedPriorityQueue {
  public:
-  Pathfinder(std::unique_ptr<NodeProcessor> processor);
-  std::vector<Vector2f> FindPath(const Vector2f& from, const Vector2f& to, float ship_radius);
+  void Push(T item) {
+    container_.push_back(item);
+    SiftUp(container_.size() - 1);
+  }
+
+  T Pop() {
+    T item = container_.front();
+    T last = container_.back();
+
+    container_.pop_back();
+
+    if (!container_.empty()) {
+      container_[0] = last;
+      SiftDown(0);
+    }
+
+    return item;
+  }
+
+  // Moves the item up the heap after its priority has improved. The item must already be in the heap.
+  void Decrease(T item) { SiftUp(index_of_.Get(item)); }
+
+  // Moves the item after its priority changed in either direction. The item must already be in the heap.
+  void Update(T item) {
+    SiftUp(index_of_.Get(item));
+    SiftDown(index_of_.Get(item));
+  }
+
+  // Removes the item from anywhere in the heap. The item must already be in the heap.
+  void Remove(T item) {
+    std::size_t index = index_of_.Get(item);
+    T last = container_.back();
+
+    container_.pop_back();
+
+    if (index < container_.size()) {
+      container_[index] = last;
+      SiftUp(index);
+      SiftDown(index_of_.Get(last));
+    }
+  }
+
+  T Top() const { return container_.front(); }
+
+  void Clear() { container_.clear(); }
+  std::size_t Size() const { return container_.size(); }
+  bool Empty() const { return container_.empty(); }
+
+ private:
+  void SiftUp(std::size_t index) {
+    T item = container_[index];
+
+    while (index > 0) {
+      std::size_t parent = (index - 1) / 2;
+
+      if (!comparator_(container_[parent], item)) break;
+
+      container_[index] = container_[parent];
+      index_of_.Set(container_[index], (u32)index);
+      index = parent;
+    }
+
+    container_[index] = item;
+    index_of_.Set(item, (u32)index);
+  }
+
+  void SiftDown(std::size_t index) {
+    T item = container_[index];
+    std::size_t size = container_.size();
+
+    while (true) {
+      std::size_t child = index * 2 + 1;
+
+      if (child >= size) break;
+
+      if (child + 1 < size && comparator_(container_[child], container_[child + 1])) {
+        ++child;
+      }
+
+      if (!comparator_(item, container_[child])) break;
+
+      container_[index] = container_[child];
+      index_of_.Set(container_[index], (u32)index);
+      index = child;
+    }
+
+    container_[index] = item;
+    index_of_.Set(item, (u32)index);
+  }
+
+  std::vector<T> container_;
+  Compare comparator_;
+  IndexOf index_of_;
+};
+
+// Open set that groups items into buckets of fixed-width priority ranges, so push, pop and decrease are constant time.
+// Items within a bucket come out in any order, so a search can end with a path that costs up to about a bucket width
+// more than the best one. Items pushed with a priority below the bucket being popped are added to that bucket.
+// PriorityOf must provide Get(item) for the item's current priority. Decreasing an item's priority adds it again, and
+// the old entry is skipped when it's reached because its priority no longer matches the item.
+// The size only counts items that are in the queue, so an item that was popped must be pushed again rather than
+// decreased. Otherwise its new entry isn't counted and the queue can be empty while it still has entries.
+template <typename T, typename PriorityOf>
+class BucketQueue {
+ public:
+  BucketQueue(float bucket_width = 1.0f) { SetBucketWidth(bucket_width); }
+
+  void SetBucketWidth(float bucket_width) {
+    Clear();
+    bucket_scale_ = 1.0f / bucket_width;
+  }
+
+  void Push(T item) {
+    Insert(item);
+    ++size_;
+  }
+
+  T Pop() {
+    while (true) {
+      std::vector<Entry>& bucket = buckets_[current_];
+
+      while (!bucket.empty()) {
+        Entry entry = bucket.back();
+        bucket.pop_back();
+
+        if (entry.priority == priority_of_.Get(entry.item)) {
+          --size_;
+          return entry.item;
+        }
+      }
+
+      ++current_;
+    }
+  }
+
+  // Adds the item again with its lower priority. The item must already be in the queue and not popped since it was
+  // pushed.
+  void Decrease(T item) { Insert(item); }
+
+  void Clear() {
+    for (size_t i = current_; i < used_end_; ++i) {
+      buckets_[i].clear();
+    }
+
+    current_ = 0;
+    used_end_ = 0;
+    size_ = 0;
+  }
+
+  std::size_t Size() const { return size_; }
+  bool Empty() const { return size_ == 0; }
+
+ private:
+  struct Entry {
+    T item;
+    float priority;
+  };
 
-  void CreateMapWeights(const Map& map, float ship_radius, bool linear_weights);
+  void Insert(T item) {
+    float priority = priority_of_.Get(item);
+    size_t index = (size_t)(priority * bucket_scale_);
 
+    // Rounding can put an item just below the bucket being popped. It's still the lowest, so it goes in that bucket.
+    if (index < current_) index = current_;
+
+    if (index >= buckets_.size()) buckets_.resize(index + 1);
+    if (index >= used_end_) used_end_ = index + 1;
+
+    buckets_[index].push_back({item, priority});
+  }
+
+  std::vector<std::vector<Entry>> buckets_;
+  size_t current_ = 0;
+  // One past the highest bucket that has been used since the last clear.
+  size_t used_end_ = 0;
+  size_t size_ = 0;
+  float bucket_scale_ = 1.0f;
+  PriorityOf priority_of_;
+};
+
+// The open set implementations that a Pathfinder can search with.
+enum class OpenSetType {
+  // Exact binary heap.
+  BinaryHeap,
+  // BucketQueue with quantized f, which is faster but can return slightly longer paths.
+  Buckets,
+};
+
+// Node::generation is stored in 12 bits, so the generation wraps at this value.
+// Every node is reset when it wraps, so starting a search costs a pass over all of the nodes once every 4095 searches.
+constexpr u32 kNodeGenerationCount = 1 << 12;
+
+// The mutable A* state for one search.
+// Searches that run at the same time each need their own context, but they can share the same NodeProcessor.
+class SearchContext {
+ public:
   struct NodeCompare {
     bool operator()(const Node* lhs, const Node* rhs) const { return lhs->f > rhs->f; }
   };
 
+  struct NodeHeapIndex {
+    u32 Get(const Node* node) const { return node->heap_index; }
+    void Set(Node* node, u32 index) const { node->heap_index = index; }
+  };
+
+  struct NodePriority {
+    float Get(const Node* node) const { return node->f; }
+  };
+
+  SearchContext() : nodes_(kMaxNodes) {}
+
+  // Starts a new search generation. Every node's search state becomes stale without having to touch the nodes.
+  void BeginSearch();
+
+  Node* GetNode(NodePoint point);
+
+  inline u32 GetIndex(const Node* node) const { return (u32)(node - &nodes_[0]); }
+  inline NodePoint GetPoint(const Node* node) const { return NavGraph::GetPoint(GetIndex(node)); }
+
+  inline Node* GetParent(const Node* node) {
+    if (node->parent == kInvalidNodeIndex) return nullptr;
+    return &nodes_[node->parent];
+  }
+
+  // Returns the arrival time storage for timed searches. It's only allocated once a timed search uses it.
+  std::vector<float>& GetArrivalTimes() {
+    if (arrival_times_.empty()) arrival_times_.resize(kMaxNodes);
+    return arrival_times_;
+  }
+
+  IndexedPriorityQueue<Node*, NodeCompare, NodeHeapIndex> openset_;
+  BucketQueue<Node*, NodePriority> bucket_openset_;
+
+ private:
+  std::vector<Node> nodes_;
+  // The time that the ship reaches each node in a timed search. This is kept out of Node so it stays small.
+  std::vector<float> arrival_times_;
+
+  // Nodes are only initialized for the current search if their generation matches this.
+  u32 generation_ = 1;
+};
+
+struct PathQuery {
+  Vector2f from;
+  Vector2f to;
+  float ship_radius;
+
+  PathQuery() : ship_radius(0.0f) {}
+  PathQuery(Vector2f from, Vector2f to, float ship_radius) : from(from), to(to), ship_radius(ship_radius) {}
+};
+
+// Settings for a search that plans around temporary obstacles.
+struct TimedSearch {
+  // Must be set for a timed search.
+  const TemporaryObstacles* obstacles = nullptr;
+  // The time that the ship starts at the path's start.
+  float start_time = 0.0f;
+  // Ship speed in tiles per second. This turns distances into arrival times and waiting into path cost.
+  // It must be above zero or no path is found.
+  float speed = 1.0f;
+};
+
+class IncrementalSearch;
+
+struct Pathfinder {
+ public:
+  Pathfinder(std::unique_ptr<NodeProcessor> processor);
+  ~Pathfinder();
+  std::vector<Vector2f> FindPath(const Vector2f& from, const Vector2f& to, float ship_radius);
+  // Finds a path using the provided search state instead of the Pathfinder's own.
+  // This doesn't modify the Pathfinder, so it can run on multiple threads at once as long as each one has its own context.
+  std::vector<Vector2f> FindPath(SearchContext& context, const Vector2f& from, const Vector2f& to,
+                                 float ship_radius) const;
+
+  // Finds a path around the timed search's temporary obstacles. A blocked node can be waited for when that is cheaper
+  // than going around it, where waiting costs the distance the ship could have moved in that time. A start that is
+  // blocked is waited in until it opens.
+  // The time that the ship reaches each path point is written to arrival_times if it's not null. The ship should wait
+  // before leaving a point if it would reach the next point before that point's arrival time.
+  std::vector<Vector2f> FindPath(const Vector2f& from, const Vector2f& to, float ship_radius, const TimedSearch& timed,
+                                 std::vector<float>* arrival_times);
+  std::vector<Vector2f> FindPath(SearchContext& context, const Vector2f& from, const Vector2f& to, float ship_radius,
+                                 const TimedSearch& timed, std::vector<float>* arrival_times) const;
+
+  // Finds a path like FindPath, but keeps the search tree for the next call. The tree is repaired for a start or goal
+  // that moved and for graph updates instead of searching again, which is much cheaper for a ship chasing a target that
+  // only moves a little between calls.
+  std::vector<Vector2f> FindPathIncremental(const Vector2f& from, const Vector2f& to, float ship_radius);
+
+  // Follows the flow field from the position to its goal, so any number of ships going to the same goal can share one
+  // field. The path is in the same form as the other searches. The field must be built from this pathfinder's graph.
+  std::vector<Vector2f> FindPath(const FlowField& field, const Vector2f& from, float ship_radius) const;
+
+  // Finds a path for every query on the worker pool. The path for queries[i] is written to paths[i].
+  // Queries without a matching output slot are skipped.
+  void FindPaths(std::span<const PathQuery> queries, std::span<std::vector<Vector2f>> paths);
+
+  // Selects the open set used by every search. The bucket width is in path cost and only used by OpenSetType::Buckets.
+  void SetOpenSet(OpenSetType type, float bucket_width = 0.25f) {
+    open_set_type_ = type;
+    bucket_width_ = bucket_width;
+  }
+
+  // Enables jump point search for searches without temporary obstacles. Open areas are crossed by jumping between the
+  // nodes at their edges instead of expanding every node, and every other node is expanded normally. Paths cost the
+  // same as without it. Enabling builds the jump distances from the current graph, and the graph builds keep them
+  // updated after that.
+  void SetJumpPointSearch(bool enabled);
+
+  // Enables hierarchical searches for paths without temporary obstacles between clusters that aren't touching. These
+  // search the ClusterGraph and join its cached paths instead of searching every node, so they are much faster but can
+  // cost a little more. Enabling builds the cluster graph from the current graph, and the graph builds keep it updated
+  // after that.
+  void SetHierarchicalSearch(bool enabled);
+
+  // Builds count landmark cost tables and uses them as a lower bound in every search together with the distance, which
+  // keeps searches around walls and weighted areas from opening as many nodes. Paths cost the same as without them.
+  // Zero disables them. The thread count works like it does for CreateMapWeights.
+  // Building takes seconds, so graph updates and loading the nav cache only mark the tables stale instead of building
+  // them again. Searches go back to the distance until UpdateLandmarks builds them.
+  void SetLandmarks(size_t count, size_t thread_count = 1);
+  // Builds the landmark tables again if they are stale, with the thread count from SetLandmarks. This should be called
+  // once the map has stopped changing for a while, since doors can make the tables stale every few seconds. It must not
+  // run while a search is using them.
+  void UpdateLandmarks();
+
+  // Uses the registry's connected regions to reject searches that can't reach their goal before searching. It's only
+  // used by searches with the registry's radius. When snapping, a goal outside of the start's region is moved to the
+  // closest node in the start's region so the path gets as close as it can. Otherwise no path is returned right away.
+  // The registry isn't owned and must be kept updated with the map, or cleared with nullptr.
+  void SetRegionRegistry(const RegionRegistry* registry, bool snap_goals = true) {
+    region_registry_ = registry;
+    snap_goals_ = snap_goals;
+  }
+
+  // Sets the number of worker threads used by FindPaths. Zero uses the hardware thread count.
+  // Each worker keeps its own SearchContext, so this should be set once rather than per batch.
+  void SetThreadCount(size_t thread_count);
+
+  // Builds the navigation graph for the ship radius. A thread count of one builds it on the calling thread. Any other
+  // count builds it on the worker pool shared with FindPaths, which is created with that count if there isn't one yet.
+  // The result is the same for any thread count.
+  void CreateMapWeights(const Map& map, float ship_radius, bool linear_weights, size_t thread_count = 1);
+  // Rebuilds the navigation data around tiles that changed solidity or changed between safe and unsafe, using the
+  // settings from CreateMapWeights.
+  // The graph is modified in place, so this must not run while a search is using it.
+  void UpdateMapWeights(const Map& map, std::span<const MapRect> changed);
+
   std::unique_ptr<NodeProcessor> processor_;
-  PriorityQueue<Node*, NodeCompare> openset_;
-  std::vector<Node*> touched_;
+  std::unique_ptr<SearchContext> context_;
+
+  std::unique_ptr<ThreadPool> thread_pool_;
+  std::vector<std::unique_ptr<SearchContext>> worker_contexts_;
+
   std::vector<Vector2f> debug_diagonals_;
+
+  // The settings from the last CreateMapWeights call so updates can rebuild with them.
+  float ship_radius_ = 0.0f;
+  bool linear_weights_ = false;
+
+  OpenSetType open_set_type_ = OpenSetType::BinaryHeap;
+  float bucket_width_ = 0.25f;
+
+  bool jump_point_search_ = false;
+  // The number of steps from a jump node to the first node that isn't one in each cardinal direction, in CoordOffset
+  // index order. This is zero for nodes that aren't jump nodes.
+  // Jump nodes are traversable with a weight of one and every edge, and so are all of their neighbors. Any path across
+  // them costs the octile distance, so a search can jump over them.
+  std::vector<u16> jump_distances_[4];
+
+  std::unique_ptr<ClusterGraph> cluster_graph_;
+  std::unique_ptr<Landmarks> landmarks_;
+  size_t landmark_thread_count_ = 1;
+
+  const RegionRegistry* region_registry_ = nullptr;
+  bool snap_goals_ = true;
+
+  // The tree kept by FindPathIncremental. It's only allocated once it's used.
+  std::unique_ptr<IncrementalSearch> incremental_search_;
+
+ private:
+  // Returns the shared worker pool for a build with the thread count, creating it with that count if there isn't one
+  // yet. A thread count of one builds on the calling thread, so there's no pool.
+  ThreadPool* GetThreadPool(size_t thread_count);
+
+  // Checks the region registry for whether the goal can be reached and snaps it if it can't. Returns false if there is
+  // no path to search for.
+  bool ResolveGoal(const Vector2f& from, Vector2f& to, float ship_radius) const;
+
+  // Rebuilds the jump distances of every row and column that crosses the rect.
+  void BuildJumpDistances(const MapRect& rect);
+
+  inline bool IsJumpNode(u32 index) const { return jump_distances_[0][index] != 0; }
+
+  // Runs the search with the selected open set.
+  template <bool kTimed>
+  std::vector<Vector2f> Search(SearchContext& context, const Vector2f& from, const Vector2f& to, float ship_radius,
+                               const TimedSearch* timed, std::vector<float>* arrival_times) const;
+
+  // The timed search is only used when kTimed is set, so static searches don't pay for the obstacle checks.
+  // Jump nodes are only jumped over when kJumpPoint is set.
+  template <bool kTimed, bool kJumpPoint, typename OpenSet>
+  std::vector<Vector2f> Search(SearchContext& context, OpenSet& openset, const Vector2f& from, const Vector2f& to,
+                               float ship_radius, const TimedSearch* timed, std::vector<float>* arrival_times) const;
 };
 
 }  // namespace path
@@ -0,0 +1,56 @@
+#include "TemporaryObstacles.h"
+
+#include <cmath>
+
+namespace elm {
+namespace path {
+
+void TemporaryObstacles::Add(const MapRect& tiles, float ship_radius, float blocked_until) {
+  if (blocked_until_.empty()) {
+    blocked_until_.resize(1024 * 1024, 0.0f);
+  }
+
+  // This is the same square that Map::CanOccupy checks around a node.
+  s32 occupy_radius = (s32)std::floor(ship_radius + 0.5f);
+  MapRect blocked = tiles.Expand(occupy_radius);
+
+  for (s32 y = blocked.start_y; y <= blocked.end_y; ++y) {
+    for (s32 x = blocked.start_x; x <= blocked.end_x; ++x) {
+      u32 index = (u32)y * 1024 + x;
+      float& until = blocked_until_[index];
+
+      if (blocked_until > until) {
+        if (until == 0.0f) {
+          blocked_nodes_.push_back(index);
+        }
+
+        until = blocked_until;
+      }
+    }
+  }
+}
+
+void TemporaryObstacles::Expire(float time) {
+  size_t kept = 0;
+
+  for (u32 index : blocked_nodes_) {
+    if (blocked_until_[index] <= time) {
+      blocked_until_[index] = 0.0f;
+    } else {
+      blocked_nodes_[kept++] = index;
+    }
+  }
+
+  blocked_nodes_.resize(kept);
+}
+
+void TemporaryObstacles::Clear() {
+  for (u32 index : blocked_nodes_) {
+    blocked_until_[index] = 0.0f;
+  }
+
+  blocked_nodes_.clear();
+}
+
+}  // namespace path
+}  // namespace elm
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <elm/Map.h>
+#include <elm/Types.h>
+
+#include <vector>
+
+namespace elm {
+namespace path {
+
+// Tiles that are solid until a known time, such as bricks.
+// These are kept out of the Map so the static navigation data doesn't need to change while they exist. Timed searches
+// check them while expanding nodes, so the path can wait for an obstacle to expire or go around it.
+class TemporaryObstacles {
+ public:
+  // Blocks every node where a ship with the radius would touch one of the tiles until the time.
+  void Add(const MapRect& tiles, float ship_radius, float blocked_until);
+  // Removes the nodes that are no longer blocked at the time.
+  void Expire(float time);
+  void Clear();
+
+  bool Empty() const { return blocked_nodes_.empty(); }
+
+  // Returns the time that the node stops being blocked. Nodes that aren't blocked return zero.
+  // Timed searches call this for every edge they expand, so it's a lookup into a dense array instead of a hash map.
+  inline float GetBlockedUntil(u32 index) const {
+    if (blocked_nodes_.empty()) return 0.0f;
+
+    return blocked_until_[index];
+  }
+
+ private:
+  // One time per node. This is only allocated when the first obstacle is added.
+  std::vector<float> blocked_until_;
+  // The nodes with a time in blocked_until_, so expiring and clearing don't need to scan every node.
+  std::vector<u32> blocked_nodes_;
+};
+
+}  // namespace path
+}  // namespace elm